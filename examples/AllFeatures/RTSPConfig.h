@@ -6,7 +6,7 @@
 //#define RTSP_LOGGING_ENABLED // save 7.7kb of flash
 
 // User defined options in sketch
-//#define OVERRIDE_RTSP_SINGLE_CLIENT_MODE // Override the default behavior of allowing only one client for unicast or TCP
 //#define RTSP_VIDEO_NONBLOCK // Enable non-blocking video streaming by creating a separate task for video streaming, preventing it from blocking the main video task.
+//#define RTSP_AUDIO_NONBLOCK // Enable non-blocking audio streaming by queueing audio blocks for a separate sender task, so the I2S read loop never waits on the network.
 
 #endif // RTSP_CONFIG_H
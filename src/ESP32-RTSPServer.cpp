@@ -1,12 +1,29 @@
 #include "ESP32-RTSPServer.h"
 
-const char* RTSPServer::LOG_TAG = "RTSPServer";
+const char* RTSPServerBase::LOG_TAG = "RTSPServer";
+
+// Tracks point at and compare against the format descriptors, so before C++17 they need a definition
+constexpr RTSP_PayloadInfo RTSPJpegFormat::info;
+constexpr RTSP_PayloadInfo RTSPL16Format::info;
+constexpr RTSP_PayloadInfo RTSPDvi4Format::info;
+constexpr RTSP_PayloadInfo RTSPOpusFormat::info;
+constexpr RTSP_PayloadInfo RTSPT140Format::info;
+
+// Cached frames go to PSRAM when the board has it
+static void* frameRealloc(void* ptr, size_t size) {
+  return psramFound() ? ps_realloc(ptr, size) : realloc(ptr, size);
+}
 
-RTSPServer::RTSPServer()
+RTSPServerBase::RTSPServerBase(const RTSPMediaCaps& caps)
   : rtpFps(0),
     // User can change these settings
     transport(VIDEO_AND_SUBTITLES), // Default transport 
     sampleRate(0),
+    audioCodec(AUDIO_L16),
+    audioPtime(0),
+    silenceMode(SILENCE_SEND),
+    opusBitrate(24000),
+    opusComplexity(3),
     rtspPort(554),
     rtpIp(IPAddress(239, 255, 0, 1)), // Default RTP IP 
     rtpTTL(64), // Default TTL
@@ -14,63 +31,82 @@ RTSPServer::RTSPServer()
     rtpAudioPort(5432),
     rtpSubtitlesPort(5434),
     maxRTSPClients(3),
+    bandwidthBudgetKbps(0),
+    relayUrl(NULL),
+    relayAsProxy(false),
     //
+    caps(caps),
     rtspSocket(-1),
-    videoUnicastSocket(-1),
-    audioUnicastSocket(-1), 
-    subtitlesUnicastSocket(-1),
-    videoMulticastSocket(-1),
-    audioMulticastSocket(-1),
-    subtitlesMulticastSocket(-1),
+    trackCount(0),
+    videoTrack(-1),
+    audioTrack(-1),
+    subtitlesTrack(-1),
+    backchannelTrack(-1),
+    mountCount(1),
     activeRTSPClients(0),
     maxClients(1),
     rtpVideoTaskHandle(NULL),
+    rtpAudioTaskHandle(NULL),
     rtspTaskHandle(NULL),
-    rtspStreamBuffer(NULL),
-    rtspStreamBufferSize(0),
+    firstRtpTracks(0),
+    firstRtpMs(0),
+    committedKbpsEstimate(0),
+    committedRefreshMs(0),
+    rtpIpAddr(0),
+    audioRing(NULL),
+    audioTalkspurt(true),
+    audioSilent(false),
+    silentSamples(0),
+    backchannelFormat(NULL),
+    backchannelRate(0),
+    backchannelPort(0),
+    backchannel(NULL),
+    backchannelSsrc(0),
+    backchannelLastMs(0),
     rtpFrameSent(true),
     rtpAudioSent(true),
     rtpSubtitlesSent(true),
-    vQuality(0),
-    vWidth(0),
-    vHeight(0),
-    videoSequenceNumber(0),
-    videoTimestamp(0),
-    audioSequenceNumber(0),
-    audioTimestamp(0),
-    subtitlesSequenceNumber(0),
-    subtitlesTimestamp(0),
     rtpFrameCount(0),
     lastRtpFPSUpdateTime(0),
-    videoCh(0),
-    audioCh(0),
-    subtitlesCh(0),
     isVideo(false),
     isAudio(false),
     isSubtitles(false),
     isPlaying(false),
-    firstClientConnected(false),
-    firstClientIsMulticast(false),
-    firstClientIsTCP(false),
-    authEnabled(false) // Initialize authEnabled to false
+    authEnabled(false), // Initialize authEnabled to false
+    sdpSessionId(0),
+    sdpVersion(0),
+    dateLineTime(0)
 {
     isPlayingMutex = xSemaphoreCreateMutex(); // Initialize the mutex
     sendTcpMutex = xSemaphoreCreateMutex(); // Initialize the mutex
     maxClientsMutex = xSemaphoreCreateMutex();
+    profilesMutex = xSemaphoreCreateMutex();
+    backchannelMutex = xSemaphoreCreateMutex();
+    for (uint8_t i = 0; i < RTSP_MAX_MOUNTS; i++) {
+      this->mounts[i].frames.setAllocator(frameRealloc);
+    }
 #ifdef RTSP_LOGGING_ENABLED
     esp_log_level_set(LOG_TAG, ESP_LOG_DEBUG); // Set log level to DEBUG
 #endif
 }
 
-RTSPServer::~RTSPServer() {
+RTSPServerBase::~RTSPServerBase() {
   // Clean up resources
   deinit();
   vSemaphoreDelete(this->isPlayingMutex);
   vSemaphoreDelete(this->sendTcpMutex);
   vSemaphoreDelete(this->maxClientsMutex);
+  vSemaphoreDelete(this->profilesMutex);
+  vSemaphoreDelete(this->backchannelMutex);
+  delete this->backchannel;
+#ifndef RTSP_DISABLE_OPUS
+  for (uint8_t i = 0; i < RTSP_MAX_TRACKS; i++) {
+    this->tracks[i].opus.release();
+  }
+#endif
 }
 
-bool RTSPServer::init(TransportType transport, uint16_t rtspPort, uint32_t sampleRate, uint16_t port1, uint16_t port2, uint16_t port3, IPAddress rtpIp, uint8_t rtpTTL) {
+bool RTSPServerBase::init(TransportType transport, uint16_t rtspPort, uint32_t sampleRate, uint16_t port1, uint16_t port2, uint16_t port3, IPAddress rtpIp, uint8_t rtpTTL) {
   this->transport = (transport != NONE) ? transport : this->transport;
   this->rtspPort = (rtspPort != 0) ? rtspPort : this->rtspPort;
   this->rtpIp = (rtpIp != IPAddress()) ? rtpIp : this->rtpIp;
@@ -135,10 +171,67 @@ bool RTSPServer::init(TransportType transport, uint16_t rtspPort, uint32_t sampl
       return false;
   }
 
+  if ((this->isVideo && !this->caps.video) || (this->isAudio && !this->caps.audio) || (this->isSubtitles && !this->caps.subtitles)) {
+    RTSP_LOGE(LOG_TAG, "Transport type needs a track this build's media policy leaves out");
+    return false;
+  }
+  if (this->isAudio && !audioCodecBuilt(this->audioCodec)) {
+    RTSP_LOGE(LOG_TAG, "Audio codec %d is left out of this build's media policy", this->audioCodec);
+    return false;
+  }
+  // Every mount must get its track, so a configuration that does not fit fails here rather than streaming without media
+  uint8_t mainTracks = (this->isVideo ? 1 : 0) + (this->isAudio ? 1 : 0) + (this->isSubtitles ? 1 : 0);
+  if (mainTracks + extraTracks() > RTSP_MAX_TRACKS) {
+    RTSP_LOGE(LOG_TAG, "Transport type, mounts and backchannel need %u tracks, raise RTSP_MAX_TRACKS", mainTracks + extraTracks());
+    return false;
+  }
+
+  if (this->isAudio) {
+    size_t frameSamples;
+    if (!audioFrameSamples(audioFormat(this->audioCodec), this->sampleRate, frameSamples)) {
+      return false;
+    }
+    if (!this->audioFramer.configure(frameSamples)) {
+      RTSP_LOGE(LOG_TAG, "Failed to allocate the audio packet buffer");
+      return false;
+    }
+    this->audioTalkspurt = true;
+    this->audioClock.reset();
+    this->voiceDetector.configure(this->sampleRate, RTSP_VAD_HANGOVER_MS);
+    this->audioSilent = false;
+  }
+
+  // Register the tracks in SDP order; SSRCs are derived from the MAC
+  uint64_t mac = ESP.getEfuseMac();
+  this->trackCount = 0;
+  this->videoTrack = this->isVideo ? registerTrack(RTSPJpegFormat::info, "video", this->rtpVideoPort, static_cast<uint32_t>(mac & 0xFFFFFFFF)) : -1;
+  this->audioTrack = this->isAudio ? registerTrack(audioFormat(this->audioCodec), "audio", this->rtpAudioPort, static_cast<uint32_t>((mac >> 32) & 0xFFFFFFFF), "sendrecv") : -1;
+  if (this->audioTrack >= 0) {
+    if (!setupAudioTrack(this->audioTrack, this->sampleRate)) {
+      return false;
+    }
+    // Opus receivers conceal gaps themselves, so silences are only left out
+    this->tracks[this->audioTrack].comfortNoise = this->silenceMode == SILENCE_COMFORT_NOISE && this->audioCodec != AUDIO_OPUS;
+  }
+  this->subtitlesTrack = this->isSubtitles ? registerTrack(RTSPT140Format::info, "subtitles", this->rtpSubtitlesPort, static_cast<uint32_t>((mac >> 48) & 0xFFFFFFFF)) : -1;
+  // The client sends on the backchannel, so like ONVIF the server offers it as sendonly from the client's view
+  this->backchannelTrack = this->backchannel != NULL ? registerTrack(*this->backchannelFormat, "backchannel", this->backchannelPort, static_cast<uint32_t>((mac >> 16) & 0xFFFFFFFF), "sendonly") : -1;
+  if (this->backchannelTrack >= 0) {
+    this->tracks[this->backchannelTrack].clockRate = this->backchannelRate;
+    this->backchannel->configure(this->backchannelRate, RTSP_BACKCHANNEL_MIN_DELAY_MS, RTSP_BACKCHANNEL_MAX_DELAY_MS);
+    this->backchannelSsrc = 0;
+    this->backchannelLastMs = 0;
+  }
+  for (uint8_t i = 0; i < this->mountCount; i++) {
+    setupMount(i);
+  }
+  this->sdpSessionId = esp_random();
+  setMaxClients(this->maxRTSPClients);
+
   return prepRTSP();
 }
 
-void RTSPServer::deinit() {
+void RTSPServerBase::deinit() {
   if (this->rtspTaskHandle != NULL) {
     vTaskDelete(this->rtspTaskHandle);
     this->rtspTaskHandle = NULL;
@@ -147,6 +240,15 @@ void RTSPServer::deinit() {
     vTaskDelete(this->rtpVideoTaskHandle);
     this->rtpVideoTaskHandle = NULL;
   }
+  if (this->rtpAudioTaskHandle != NULL) {
+    vTaskDelete(this->rtpAudioTaskHandle);
+    this->rtpAudioTaskHandle = NULL;
+  }
+  if (this->audioRing != NULL) {
+    delete this->audioRing;
+    this->audioRing = NULL;
+  }
+  this->eventLoop.end();
   if (this->rtspSocket >= 0) {
     close(this->rtspSocket);
     this->rtspSocket = -1;
@@ -154,50 +256,345 @@ void RTSPServer::deinit() {
   
   closeSockets();
   
-  if (this->rtspStreamBuffer) {
-    free(this->rtspStreamBuffer);
+  for (uint8_t i = 0; i < this->mountCount; i++) {
+    this->mounts[i].pendingFrame = NULL;
+    this->mounts[i].frames.reset();
   }
 
   RTSP_LOGI(LOG_TAG, "RTSP server deinitialized.");
 }
 
-bool RTSPServer::reinit() {
+bool RTSPServerBase::reinit() {
   deinit();
   return init();
 }
 
-void RTSPServer::closeSockets() {
-  if (videoUnicastSocket != -1) {
-    close(videoUnicastSocket);
-    videoUnicastSocket = -1;
+void RTSPServerBase::closeSockets() {
+  for (uint8_t i = 0; i < this->trackCount; i++) {
+    RTSP_Track& track = this->tracks[i];
+    if (track.unicastSocket != -1) {
+      if (i == this->backchannelTrack) {
+        this->eventLoop.remove(track.unicastSocket, RTSPServerEventLoop::kMedia);
+      }
+      close(track.unicastSocket);
+      track.unicastSocket = -1;
+    }
+    if (track.multicastSocket != -1) {
+      close(track.multicastSocket);
+      track.multicastSocket = -1;
+    }
+  }
+}
+
+int8_t RTSPServerBase::registerTrack(const RTSP_PayloadInfo& format, const char* control, uint16_t serverPort, uint32_t ssrc, const char* direction) {
+  if (this->trackCount >= RTSP_MAX_TRACKS) {
+    RTSP_LOGE(LOG_TAG, "Too many tracks, %s not registered", control);
+    return -1;
+  }
+  RTSP_Track& track = this->tracks[this->trackCount];
+  track.format = &format;
+  track.control = control;
+  track.direction = direction;
+  track.clockRate = format.clockRate != 0 ? format.clockRate : this->sampleRate;
+  track.ticksPerSample = 1;
+  track.ptime = 0;
+  track.comfortNoise = false;
+  track.serverPort = serverPort;
+  track.unicastSocket = -1;
+  track.multicastSocket = -1;
+  track.stream.sequenceNumber = 0;
+  track.stream.timestamp = 0;
+  track.stream.ssrc = ssrc;
+#ifndef RTSP_DISABLE_DVI4
+  track.adpcm.predictor = 0;
+  track.adpcm.stepIndex = 0;
+#endif
+  this->trackRates[this->trackCount].reset();
+  return static_cast<int8_t>(this->trackCount++);
+}
+
+const RTSP_PayloadInfo& RTSPServerBase::audioFormat(AudioCodec codec) {
+  switch (codec) {
+    case AUDIO_PCMU:
+      return RTSPPcmuFormat::info;
+    case AUDIO_PCMA:
+      return RTSPPcmaFormat::info;
+    case AUDIO_DVI4:
+      return RTSPDvi4Format::info;
+    case AUDIO_OPUS:
+      return RTSPOpusFormat::info;
+    default:
+      return RTSPL16Format::info;
+  }
+}
+
+/**
+ * @brief Checks that an audio format can be sent at a sample rate and works
+ * out the samples per packet at audioPtime, 0 when packets follow the blocks.
+ */
+bool RTSPServerBase::audioFrameSamples(const RTSP_PayloadInfo& format, uint32_t rate, size_t& frameSamples) const {
+  if (!audioRateFits(format, rate)) {
+    RTSP_LOGE(LOG_TAG, "Audio payload type %u can not be sent at a sample rate of %lu", format.payloadType, static_cast<unsigned long>(rate));
+    return false;
+  }
+  uint8_t ptime = audioPtimeFor(format);
+  frameSamples = rate * ptime / 1000;
+  if (&format == &RTSPOpusFormat::info) {
+    // Opus encodes whole frames of set lengths only
+    if (ptime != 5 && ptime != 10 && ptime != 20 && ptime != 40 && ptime != 60) {
+      RTSP_LOGE(LOG_TAG, "Opus needs an audio ptime of 5, 10, 20, 40 or 60 ms, not %u", ptime);
+      return false;
+    }
+    return true;
   }
-  if (audioUnicastSocket != -1) {
-    close(audioUnicastSocket);
-    audioUnicastSocket = -1;
+  // A packet at the requested ptime has to fit in one RTP packet of the codec
+  size_t frameBytes = &format == &RTSPL16Format::info ? frameSamples * 2 : (&format == &RTSPDvi4Format::info ? (frameSamples + 1) / 2 : frameSamples);
+  if (ptime != 0 && (frameSamples == 0 || frameBytes > format.maxPayload)) {
+    RTSP_LOGE(LOG_TAG, "An audio ptime of %u ms does not fit one packet at %lu Hz", ptime, static_cast<unsigned long>(rate));
+    return false;
   }
-  if (subtitlesUnicastSocket != -1) {
-    close(subtitlesUnicastSocket);
-    subtitlesUnicastSocket = -1;
+  return true;
+}
+
+// Whether an audio format can carry PCM at rate
+bool RTSPServerBase::audioRateFits(const RTSP_PayloadInfo& format, uint32_t rate) {
+  if (&format == &RTSPOpusFormat::info) {
+    return rate == 8000 || rate == 12000 || rate == 16000 || rate == 24000 || rate == 48000;
+  }
+  return rate != 0 && (format.clockRate == 0 || rate == format.clockRate);
+}
+
+// audioPtime, or 20 ms for Opus, which always sends whole frames
+uint8_t RTSPServerBase::audioPtimeFor(const RTSP_PayloadInfo& format) const {
+  return &format == &RTSPOpusFormat::info && this->audioPtime == 0 ? 20 : this->audioPtime;
+}
+
+/**
+ * @brief Sets up a registered audio track for PCM at rate: its RTP clock,
+ * its packet time and, for Opus, the encoder.
+ */
+bool RTSPServerBase::setupAudioTrack(int8_t trackIndex, uint32_t rate) {
+  RTSP_Track& track = this->tracks[trackIndex];
+  // The RTP clock runs at the sample rate unless the format fixes it, like Opus
+  track.clockRate = track.format->clockRate != 0 ? track.format->clockRate : rate;
+  track.ticksPerSample = static_cast<uint8_t>(track.clockRate / rate);
+  track.ptime = audioPtimeFor(*track.format);
+#ifndef RTSP_DISABLE_OPUS
+  if (track.format == &RTSPOpusFormat::info && !track.opus.configure(rate, this->opusBitrate, this->opusComplexity)) {
+    RTSP_LOGE(LOG_TAG, "Failed to set up the Opus encoder at %lu Hz; is an Opus library installed?", static_cast<unsigned long>(rate));
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Whether the media policy carries the send path of codec
+bool RTSPServerBase::audioCodecBuilt(AudioCodec codec) const {
+  return (this->caps.audioCodecs & (1 << codec)) != 0;
+}
+
+int8_t RTSPServerBase::findTrack(const RTSP_StringView& url, uint8_t trackMask) const {
+  int8_t only = -1;
+  uint8_t candidates = 0;
+  for (uint8_t i = 0; i < this->trackCount; i++) {
+    if (!(trackMask & (1 << i))) {
+      continue;
+    }
+    if (url.contains(this->tracks[i].control)) {
+      return static_cast<int8_t>(i);
+    }
+    only = static_cast<int8_t>(i);
+    candidates++;
   }
-  if (videoMulticastSocket != -1) {
-    close(videoMulticastSocket);
-    videoMulticastSocket = -1;
+  return candidates == 1 ? only : -1; // Aggregate URL on a single-track stream
+}
+
+/**
+ * @brief Adds a video substream served under its own path, e.g. "/sub".
+ *
+ * The substream gets its own JPEG track on rtpPort, its own SDP and its own
+ * frame feed: pass the returned index as the mount argument of
+ * sendRTSPFrame(). Call before init(), which sets the mount up; the sending
+ * tasks walk the mounts without a lock. The path must stay valid while the
+ * server runs.
+ *
+ * @return Mount index, or -1 if no mount or track is left, the server is
+ * running or video is not built in.
+ */
+int8_t RTSPServerBase::addVideoMount(const char* path, uint16_t rtpPort) {
+  if (!this->caps.video || path == NULL || path[0] != '/') {
+    RTSP_LOGE(LOG_TAG, "Video mounts need video support and a path starting with '/'");
+    return -1;
   }
-  if (audioMulticastSocket != -1) {
-    close(audioMulticastSocket);
-    audioMulticastSocket = -1;
+  if (this->mountCount >= RTSP_MAX_MOUNTS) {
+    RTSP_LOGE(LOG_TAG, "Too many mounts, %s not added", path);
+    return -1;
   }
-  if (subtitlesMulticastSocket != -1) {
-    close(subtitlesMulticastSocket);
-    subtitlesMulticastSocket = -1;
+  if (!reserveTrack(path)) {
+    return -1;
   }
+  uint8_t index = this->mountCount;
+  RTSP_Mount& mount = this->mounts[index];
+  mount.path = path;
+  mount.videoPort = rtpPort;
+  this->mountCount++;
+  return static_cast<int8_t>(index);
 }
 
-bool RTSPServer::prepRTSP() {
-  uint64_t mac = ESP.getEfuseMac();
-  this->videoSSRC = static_cast<uint32_t>(mac & 0xFFFFFFFF);
-  this->audioSSRC = static_cast<uint32_t>((mac >> 32) & 0xFFFFFFFF);
-  this->subtitlesSSRC = static_cast<uint32_t>((mac >> 48) & 0xFFFFFFFF);
+/**
+ * @brief Adds a variant of the main stream with its audio in another codec
+ * or at another sample rate, served under its own path, e.g. "/pcmu".
+ *
+ * The variant carries the main stream's video and subtitles and an audio
+ * track of its own on rtpPort. The audio passed to sendRTSPAudio() is
+ * resampled to rate once per block for every variant at that rate, so one
+ * microphone serves clients with different needs. Call before init(). The
+ * path must stay valid while the server runs.
+ *
+ * @return Mount index, or -1 if no mount or track is left, the server is
+ * running or the codec is not built in.
+ */
+int8_t RTSPServerBase::addAudioMount(const char* path, AudioCodec codec, uint32_t rate, uint16_t rtpPort) {
+  if (!this->caps.audio || path == NULL || path[0] != '/' || rate == 0) {
+    RTSP_LOGE(LOG_TAG, "Audio mounts need audio support, a path starting with '/' and a sample rate");
+    return -1;
+  }
+  if (!audioCodecBuilt(codec)) {
+    RTSP_LOGE(LOG_TAG, "Audio codec %d is left out of this build's media policy, %s not added", codec, path);
+    return -1;
+  }
+  const RTSP_PayloadInfo& format = audioFormat(codec);
+  if (!audioRateFits(format, rate)) {
+    RTSP_LOGE(LOG_TAG, "Audio payload type %u can not be sent at a sample rate of %lu, %s not added", format.payloadType, static_cast<unsigned long>(rate), path);
+    return -1;
+  }
+  if (this->mountCount >= RTSP_MAX_MOUNTS) {
+    RTSP_LOGE(LOG_TAG, "Too many mounts, %s not added", path);
+    return -1;
+  }
+  if (!reserveTrack(path)) {
+    return -1;
+  }
+  uint8_t index = this->mountCount;
+  RTSP_Mount& mount = this->mounts[index];
+  mount.path = path;
+  mount.audioFormat = &format;
+  mount.audioRate = rate;
+  mount.audioPort = rtpPort;
+  this->mountCount++;
+  return static_cast<int8_t>(index);
+}
+
+/**
+ * @brief Adds a backchannel track on which clients send audio to the
+ * device, e.g. to a speaker. Call before init().
+ *
+ * Received RTP, over UDP on rtpPort or interleaved on the RTSP connection,
+ * goes through an adaptive jitter buffer; readBackchannelAudio() plays it
+ * out at the pace of the caller. One client talks at a time.
+ *
+ * @return false if the codec can not be received or memory ran out.
+ */
+bool RTSPServerBase::enableBackchannel(AudioCodec codec, uint32_t rate, uint16_t rtpPort) {
+  const RTSP_PayloadInfo& format = audioFormat(codec);
+  if (codec == AUDIO_DVI4 || codec == AUDIO_OPUS || !audioRateFits(format, rate)) {
+    RTSP_LOGE(LOG_TAG, "The backchannel takes L16 at any rate or G.711 at 8000 Hz");
+    return false;
+  }
+  if (this->backchannel == NULL) {
+    if (!reserveTrack("the backchannel")) {
+      return false;
+    }
+    this->backchannel = new (std::nothrow) RTSPServerJitterBuffer();
+    if (this->backchannel == NULL) {
+      RTSP_LOGE(LOG_TAG, "Failed to allocate the backchannel jitter buffer");
+      return false;
+    }
+  }
+  this->backchannelFormat = &format;
+  this->backchannelRate = rate;
+  this->backchannelPort = rtpPort;
+  return true;
+}
+
+// Track slots taken next to the main stream's: one per substream or variant and the backchannel's
+uint8_t RTSPServerBase::extraTracks() const {
+  return static_cast<uint8_t>(this->mountCount - 1 + (this->backchannel != NULL ? 1 : 0));
+}
+
+// Claims a slot before init(), keeping one for the main stream, whose tracks are only known then
+bool RTSPServerBase::reserveTrack(const char* what) {
+  if (this->rtspSocket >= 0) {
+    RTSP_LOGE(LOG_TAG, "Streams must be added before init(), %s not added", what);
+    return false;
+  }
+  if (extraTracks() + 2 > RTSP_MAX_TRACKS) {
+    RTSP_LOGE(LOG_TAG, "RTSP_MAX_TRACKS reached, %s not added", what);
+    return false;
+  }
+  return true;
+}
+
+void RTSPServerBase::setupMount(uint8_t index) {
+  RTSP_Mount& mount = this->mounts[index];
+  if (index == 0) {
+    mount.videoTrack = this->videoTrack;
+    mount.trackMask = 0;
+    for (uint8_t i = 0; i < this->trackCount; i++) {
+      mount.trackMask |= 1 << i;
+    }
+  } else if (mount.audioFormat != nullptr) {
+    mount.videoTrack = -1;
+    mount.trackMask = 0;
+    if (this->videoTrack >= 0) {
+      mount.trackMask |= 1 << this->videoTrack;
+    }
+    if (this->subtitlesTrack >= 0) {
+      mount.trackMask |= 1 << this->subtitlesTrack;
+    }
+    size_t frameSamples;
+    mount.audioTrack = -1;
+    if (this->audioTrack < 0 || !audioFrameSamples(*mount.audioFormat, mount.audioRate, frameSamples) ||
+        !mount.resampler.configure(this->sampleRate, mount.audioRate) || !mount.audioFramer.configure(frameSamples)) {
+      RTSP_LOGE(LOG_TAG, "No audio for %s at %lu Hz", mount.path, static_cast<unsigned long>(mount.audioRate));
+    } else {
+      // Like substreams, variants get an SSRC of their own next to the main audio's
+      uint32_t ssrc = static_cast<uint32_t>((ESP.getEfuseMac() >> 32) & 0xFFFFFFFF) ^ (index * 0x9E3779B9u);
+      mount.audioTrack = registerTrack(*mount.audioFormat, "audio", mount.audioPort, ssrc, "sendrecv");
+    }
+    if (mount.audioTrack >= 0 && !setupAudioTrack(mount.audioTrack, mount.audioRate)) {
+      RTSP_LOGE(LOG_TAG, "No audio for %s", mount.path);
+      mount.audioTrack = -1;
+    }
+    if (mount.audioTrack >= 0) {
+      mount.trackMask |= 1 << mount.audioTrack;
+    }
+    mount.audioTalkspurt = true;
+    mount.audioClock.reset();
+  } else {
+    // Substreams get an SSRC of their own next to the main video's
+    uint32_t ssrc = static_cast<uint32_t>(ESP.getEfuseMac() & 0xFFFFFFFF) ^ (index * 0x9E3779B9u);
+    mount.videoTrack = registerTrack(RTSPJpegFormat::info, "video", mount.videoPort, ssrc);
+    mount.trackMask = mount.videoTrack >= 0 ? 1 << mount.videoTrack : 0;
+  }
+  mount.describeCacheDirty = true;
+}
+
+// Mount whose path the URL is under; mount 0 takes everything else
+uint8_t RTSPServerBase::findMount(const RTSP_StringView& url) const {
+  RTSP_StringView path = RTSPMountPath::ofUrl(url);
+  for (uint8_t i = 1; i < this->mountCount; i++) {
+    if (RTSPMountPath::matches(path, this->mounts[i].path)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+bool RTSPServerBase::prepRTSP() {
+  this->rtpIpAddr = static_cast<uint32_t>(this->rtpIp);
+  strncpy(this->rtpIpString, this->rtpIp.toString().c_str(), sizeof(this->rtpIpString) - 1);
+  this->rtpIpString[sizeof(this->rtpIpString) - 1] = '\0';
 
   this->rtspSocket = socket(AF_INET, SOCK_STREAM, 0);
   if (this->rtspSocket < 0) {
@@ -240,129 +637,167 @@ bool RTSPServer::prepRTSP() {
   return true;
 }
 
-void RTSPServer::rtspTaskWrapper(void* pvParameters) {
-  RTSPServer* server = static_cast<RTSPServer*>(pvParameters);
+void RTSPServerBase::rtspTaskWrapper(void* pvParameters) {
+  RTSPServerBase* server = static_cast<RTSPServerBase*>(pvParameters);
   server->rtspTask();
 }
 
-void RTSPServer::rtspTask() {
-  struct sockaddr_in clientAddr;
-  socklen_t addr_len = sizeof(clientAddr);
-  fd_set read_fds;
-  int client_sockets[MAX_CLIENTS] = {0};
-  int max_sd, activity, client_sock;
+void RTSPServerBase::rtspTask() {
+  if (!this->eventLoop.begin(this->rtspSocket)) {
+    RTSP_LOGE(LOG_TAG, "Failed to start the RTSP event loop");
+    this->rtspTaskHandle = NULL;
+    vTaskDelete(NULL);
+    return;
+  }
 
   while (true) {
-    FD_ZERO(&read_fds);
-    FD_SET(this->rtspSocket, &read_fds);
-    max_sd = this->rtspSocket;
-
-    uint8_t currentMaxClients = getMaxClients();
+    // Wakes at least once a second to refresh the uplink estimate
+    int ready = this->eventLoop.wait(1000, [this](uint16_t tag, uint8_t events) {
+      if (tag == RTSPServerEventLoop::kListener) {
+        acceptClient();
+      } else if (tag == RTSPServerEventLoop::kMedia) {
+        readBackchannelSocket();
+      } else if (tag == RTSPServerEventLoop::kWakeup) {
+        collectFirstRtp();
+        // A sender task may have queued output; watch for room to send it
+        for (size_t i = 0; i < this->sessions.size(); i++) {
+          if (this->sessions.at(i).inUse) {
+            watchClient(this->sessions.at(i));
+          }
+        }
+      } else {
+        serviceClient(this->sessions.at(tag), events);
+      }
+    });
 
-    for (int i = 0; i < currentMaxClients; i++) {
-      int sd = client_sockets[i];
-      if (sd > 0) FD_SET(sd, &read_fds);
-      if (sd > max_sd) max_sd = sd;
+    if (ready < 0 && errno != EINTR) {
+      RTSP_LOGE(LOG_TAG, "Poll error");
     }
-
-    activity = select(max_sd + 1, &read_fds, NULL, NULL, NULL);
-
-    if (activity < 0 && errno != EINTR) {
-      RTSP_LOGE(LOG_TAG, "Select error");
-      continue;
+    if (millis() - this->committedRefreshMs >= 1000) {
+      refreshCommittedKbps();
     }
+  }
+}
 
-    if (FD_ISSET(this->rtspSocket, &read_fds)) {
-      if (getActiveRTSPClients() >= currentMaxClients) {
-        client_sock = accept(this->rtspSocket, (struct sockaddr *)&clientAddr, &addr_len);
-        if (client_sock < 0) {
-          RTSP_LOGE(LOG_TAG, "Accept error");
-          continue;
-        }
+void RTSPServerBase::acceptClient() {
+  struct sockaddr_in clientAddr;
+  socklen_t addr_len = sizeof(clientAddr);
+  int client_sock = accept(this->rtspSocket, (struct sockaddr *)&clientAddr, &addr_len);
+  if (client_sock < 0) {
+    RTSP_LOGE(LOG_TAG, "Accept error");
+    return;
+  }
 
-        const char* response = "RTSP/1.0 503 Service Unavailable\r\n\r\n";
-        write(client_sock, response, strlen(response));
-        close(client_sock);
-        RTSP_LOGE(LOG_TAG, "Max clients reached. Sent 503 error to new client.");
-        continue;
-      }
+  if (!setNonBlocking(client_sock)) {
+    RTSP_LOGE(LOG_TAG, "Failed to set RTSP socket to non-blocking mode.");
+    close(client_sock);
+    return;
+  }
 
-      client_sock = accept(this->rtspSocket, (struct sockaddr *)&clientAddr, &addr_len);
-      if (client_sock < 0) {
-        RTSP_LOGE(LOG_TAG, "Accept error");
-        continue;
-      }
+  // Claim a pooled session slot for the new client
+  RTSP_Session* session = this->sessions.acquire(esp_random(), client_sock);
+  if (session == nullptr) {
+    RTSP_LOGE(LOG_TAG, "No free session slot for new client");
+    close(client_sock);
+    return;
+  }
 
-      if (!setNonBlocking(client_sock)) {
-        RTSP_LOGE(LOG_TAG, "Failed to set RTSP socket to non-blocking mode.");
-        close(client_sock);
-        continue;
-      }
+  if (!this->eventLoop.add(client_sock, session->slot)) {
+    RTSP_LOGE(LOG_TAG, "Failed to watch client socket");
+    this->sessions.release(*session);
+    close(client_sock);
+    return;
+  }
 
-      RTSP_LOGI(LOG_TAG, "New client connected");
-
-      // Create a new session for the new client
-      RTSP_Session session = {
-        esp_random(),  // sessionID
-        client_sock,   // sock
-        0,             // cseq
-        0,             // cVideoPort
-        0,             // cAudioPort
-        0,             // cSrtPort
-        false,         // isMulticast
-        false,         // isPlaying
-        false,         // isTCP
-        false,         // isHttp
-        -1,            // httpSock
-        {0},           // sessionCookie (initialized as empty)
-        LaxRTSPState(),// laxState
-        false,         // hasFallbackSdp
-        0,             // fallbackSdpLen
-        {0}            // fallbackSdp buffer
-      };
-      LaxRTSPSession::reset(session.laxState);
-      sessions[session.sessionID] = session;
-
-      for (int i = 0; i < currentMaxClients; i++) {
-        if (client_sockets[i] == 0) {
-          client_sockets[i] = client_sock;
-          incrementActiveRTSPClients();
-          RTSP_LOGI(LOG_TAG, "Added to list of sockets as %d", i);
-          break;
-        }
-      }
-    }
+  session->acceptTime = millis();
+  // Over the limit the client is still read from, so its 503 can carry the CSeq it sends
+  session->refused = getActiveRTSPClients() >= getMaxClients();
+  incrementActiveRTSPClients();
+  if (session->refused) {
+    RTSP_LOGW(LOG_TAG, "Max clients reached, refusing the client in slot %u", session->slot);
+  } else {
+    RTSP_LOGI(LOG_TAG, "New client connected in slot %u", session->slot);
+  }
+}
 
-    for (int i = 0; i < currentMaxClients; i++) {
-      int sd = client_sockets[i];
+void RTSPServerBase::serviceClient(RTSP_Session& session, uint8_t events) {
+  if (!session.inUse) {
+    return;  // Closed earlier in the same batch of events
+  }
 
-      if (FD_ISSET(sd, &read_fds)) {
-        // Get the session for this client
-        RTSP_Session* session = nullptr;
-        for (auto& sess : sessions) {
-          if (sess.second.sock == sd) {
-            session = &sess.second;
-            break;
-          }
+  bool keepConnection = true;
+  if (events & RTSPServerEventLoop::kWritable) {
+    bool drained = false;
+    if (xSemaphoreTake(sendTcpMutex, portMAX_DELAY) == pdTRUE) {
+      keepConnection = flushOutput(session) && (session.outLen > 0 || flushPriority(session));
+      drained = session.outLen == 0;
+      xSemaphoreGive(sendTcpMutex);
+    }
+    watchClient(session);
+    // Pick up requests that were left waiting for this connection to drain;
+    // several tunnel POST connections can reply over the same GET
+    if (keepConnection && drained && session.inputWaiting) {
+      session.inputWaiting = false;
+      for (size_t i = 0, n = this->sessions.size(); i < n && keepConnection; i++) {
+        RTSP_Session& waiting = this->sessions.at(i);
+        if (!waiting.inUse || !waiting.inputPaused || waiting.replySlot != session.slot) {
+          continue;
         }
-        if (session) {
-          bool keepConnection = handleRTSPRequest(*session);
-          if (!keepConnection) {
-            if (getActiveRTSPClients() == 1) {
-              setIsPlaying(false);
-              closeSockets();
-              RTSP_LOGD(LOG_TAG, "All clients disconnected. Resetting firstClientConnected flag."); 
-              this->firstClientConnected = false; 
-              this->firstClientIsMulticast = false; 
-              this->firstClientIsTCP = false; 
-            }
-            close(sd);
-            client_sockets[i] = 0;
-            sessions.erase(session->sessionID); // Remove session when client disconnects
-            decrementActiveRTSPClients();
+        waiting.inputPaused = false;
+        watchClient(waiting);
+        if (!processInput(waiting)) {
+          if (&waiting == &session) {
+            keepConnection = false;
+          } else {
+            closeClient(waiting);
           }
         }
       }
     }
   }
+  if (keepConnection && ((events & RTSPServerEventLoop::kHangup) || ((events & RTSPServerEventLoop::kReadable) && !session.inputPaused))) {
+    keepConnection = handleRTSPRequest(session);
+  }
+  if (!keepConnection) {
+    closeClient(session);
+  }
+}
+
+/**
+ * @brief Watches the socket for input unless parsing is paused, and for
+ * writability while output is queued.
+ */
+void RTSPServerBase::watchClient(RTSP_Session& session) {
+  uint8_t events = session.inputPaused ? 0 : RTSPServerEventLoop::kReadable;
+  if (session.outLen > 0 || session.priorityLen > 0) {
+    events |= RTSPServerEventLoop::kWritable;
+  }
+  if (events != session.watchedEvents) {
+    this->eventLoop.watch(session.sock, session.slot, events);
+    session.watchedEvents = events;
+  }
+}
+
+void RTSPServerBase::closeClient(RTSP_Session& session) {
+  int sd = session.sock;
+  this->eventLoop.remove(sd, session.slot);
+  if (session.profile >= 0 && xSemaphoreTake(profilesMutex, portMAX_DELAY) == pdTRUE) {
+    this->clientProfiles.release(session.profile);
+    session.profile = -1;
+    xSemaphoreGive(profilesMutex);
+  }
+  freePriority(session);
+  // Drop the session from the subscriber list and wait for the sender tasks
+  // to let go of older lists before its socket (or the shared RTP sockets)
+  // can be closed and reused.
+  this->sessions.release(session);
+  publishSubscribers();
+  this->subscribers.synchronize();
+  if (getActiveRTSPClients() == 1) {
+    setIsPlaying(false);
+    closeSockets();
+    RTSP_LOGD(LOG_TAG, "All clients disconnected.");
+  }
+  close(sd);
+  decrementActiveRTSPClients();
 }
@@ -4,19 +4,16 @@
 #include <WiFi.h>
 #include "lwip/sockets.h"
 #include <esp_log.h>
-#include <map>
 #include "LaxRTSPSession.h"
 
 class LaxRTSPCompat;
 
-#define MAX_RTSP_BUFFER (512 * 1024)
+#define MAX_RTSP_BUFFER (512 * 1024) // largest video frame buffered for the video task or instant start
 #define RTP_STACK_SIZE (1024 * 8)
 #define RTP_PRI 10
 #define RTSP_STACK_SIZE (1024 * 8)
 #define RTSP_PRI 10
-#define MAX_CLIENTS 10 // max rtsp clients
-
-#define RTSP_BUFFER_SIZE 8092
+#define RTSP_SDP_CACHE_SIZE 768 // DESCRIBE reply body and its entity headers
 
 // Optionally include RTSPConfig.h if available
 #ifdef __has_include
@@ -37,28 +34,79 @@ class LaxRTSPCompat;
   #define RTSP_LOGD(tag, format, ...)
 #endif
 
-#define MAX_COOKIE_LENGTH 128 // max length of session cookie
-
-struct RTSP_Session {
-  uint32_t sessionID;
-  int sock;
-  int cseq;
-  uint16_t cVideoPort;
-  uint16_t cAudioPort;
-  uint16_t cSrtPort;
-  bool isMulticast;
-  bool isPlaying;
-  bool isTCP;
-  bool isHttp;  // Add flag for HTTP tunneling
-  int httpSock;  // Add HTTP socket storage
-  char sessionCookie[MAX_COOKIE_LENGTH];  // Add storage for session cookie
-  LaxRTSPState laxState;
-  bool hasFallbackSdp;
-  uint16_t fallbackSdpLen;
-  char fallbackSdp[512];
-};
+#ifndef RTSP_MAX_CLIENTS
+  #define RTSP_MAX_CLIENTS 10 // max rtsp connections, sizes the session pool
+#endif
+#define MAX_CLIENTS RTSP_MAX_CLIENTS
+#ifndef RTSP_INPUT_BUFFER_SIZE
+  #define RTSP_INPUT_BUFFER_SIZE 2048 // bytes of request input buffered per connection
+#endif
+#ifndef RTSP_OUTPUT_BUFFER_SIZE
+  #define RTSP_OUTPUT_BUFFER_SIZE 2048 // bytes of replies and partial RTP packets queued per connection
+#endif
+#ifndef RTSP_PRIORITY_BUFFER_SIZE
+  #define RTSP_PRIORITY_BUFFER_SIZE 1536 // bytes of audio packets queued per connection to go ahead of video
+#endif
+#ifndef RTSP_TCP_SEND_TIMEOUT_MS
+  #define RTSP_TCP_SEND_TIMEOUT_MS 100 // longest wait for room on a TCP socket before a packet is dropped
+#endif
+#ifndef RTSP_AUDIO_RING_BLOCKS
+  #define RTSP_AUDIO_RING_BLOCKS 8 // PCM blocks queued for the audio task with RTSP_AUDIO_NONBLOCK
+#endif
+#ifndef RTSP_AUDIO_BLOCK_SIZE
+  #define RTSP_AUDIO_BLOCK_SIZE 1024 // bytes per queued PCM block
+#endif
+#ifndef RTSP_CLIENT_PROFILES
+  #define RTSP_CLIENT_PROFILES 8 // client kinds remembered by User-Agent
+#endif
+#ifndef RTSP_TCP_COST_PERCENT
+  #define RTSP_TCP_COST_PERCENT 150 // uplink cost of a TCP viewer relative to UDP, for budget admission
+#endif
+#ifndef RTSP_VAD_HANGOVER_MS
+  #define RTSP_VAD_HANGOVER_MS 300 // audio kept flowing after speech stops, with silenceMode
+#endif
+#ifndef RTSP_BACKCHANNEL_SLOTS
+  #define RTSP_BACKCHANNEL_SLOTS 16 // packets the backchannel jitter buffer holds
+#endif
+#ifndef RTSP_BACKCHANNEL_PACKET_SAMPLES
+  #define RTSP_BACKCHANNEL_PACKET_SAMPLES 320 // longest backchannel packet accepted, in samples
+#endif
+#ifndef RTSP_BACKCHANNEL_MIN_DELAY_MS
+  #define RTSP_BACKCHANNEL_MIN_DELAY_MS 20 // least audio buffered before backchannel playout
+#endif
+#ifndef RTSP_BACKCHANNEL_MAX_DELAY_MS
+  #define RTSP_BACKCHANNEL_MAX_DELAY_MS 200 // most the jitter buffer adapts up to
+#endif
+#ifndef RTSP_MAX_MOUNTS
+  #define RTSP_MAX_MOUNTS 2 // stream paths: the init() stream plus video substreams
+#endif
 
-class RTSPServer {
+#include "RTSPMediaPolicy.h"
+#include "RTSPPayloadFormat.h"
+#include "RTSPRequestParser.h"
+#include "RTSPResponse.h"
+#include "RTSPSessionPool.h"
+#include "RTSPSubscriberRegistry.h"
+#include "RTSPAudioFramer.h"
+#include "RTSPAudioRing.h"
+#include "RTSPVoiceActivity.h"
+#include "RTSPEventLoop.h"
+#include "RTSPJitterBuffer.h"
+#include "RTSPClientProfiles.h"
+#include "RTSPFrameCache.h"
+#include "RTSPMount.h"
+#include "RTSPBandwidth.h"
+
+typedef RTSPAudioRing<RTSP_AUDIO_RING_BLOCKS, RTSP_AUDIO_BLOCK_SIZE> RTSPServerAudioRing;
+typedef RTSPEventLoop<MAX_CLIENTS + 1> RTSPServerEventLoop;  // One more for the backchannel socket
+typedef RTSPJitterBuffer<RTSP_BACKCHANNEL_SLOTS, RTSP_BACKCHANNEL_PACKET_SAMPLES> RTSPServerJitterBuffer;
+
+/**
+ * @brief Control plane shared by every media policy: RTSP sockets, sessions,
+ * request handling and stream state. The per-packet send path lives in
+ * RTSPServerCore, which is specialized on a compile-time media policy.
+ */
+class RTSPServerBase {
 public:
   enum TransportType {
     VIDEO_ONLY,
@@ -71,8 +119,22 @@ public:
     NONE,
   };
 
-  RTSPServer();  // Defined in ESP32-RTSPServer.cpp
-  ~RTSPServer();  // Destructor, defined in ESP32-RTSPServer.cpp
+  enum AudioCodec {
+    AUDIO_L16,   // Uncompressed 16-bit PCM at sampleRate
+    AUDIO_PCMU,  // G.711 µ-law, needs a sample rate of 8000
+    AUDIO_PCMA,  // G.711 A-law, needs a sample rate of 8000
+    AUDIO_DVI4,  // IMA ADPCM, 4 bits per sample at sampleRate
+    AUDIO_OPUS,  // Opus speech at 8, 12, 16, 24 or 48 kHz, needs an Opus library
+  };
+
+  enum SilenceMode {
+    SILENCE_SEND,           // Send silence like any other audio
+    SILENCE_SUPPRESS,       // Send nothing while nobody speaks
+    SILENCE_COMFORT_NOISE,  // Send an RFC 3389 comfort noise packet now and then instead
+  };
+
+  explicit RTSPServerBase(const RTSPMediaCaps& caps);  // Defined in ESP32-RTSPServer.cpp
+  virtual ~RTSPServerBase();  // Destructor, defined in ESP32-RTSPServer.cpp
 
   bool init(TransportType transport = NONE, uint16_t rtspPort = 0, uint32_t sampleRate = 0, uint16_t port1 = 0, uint16_t port2 = 0, uint16_t port3 = 0, IPAddress rtpIp = IPAddress(), uint8_t rtpTTL = 255);  // Defined in ESP32-RTSPServer.cpp
   
@@ -80,12 +142,6 @@ public:
 
   bool reinit();  // Defined in ESP32-RTSPServer.cpp
 
-  void sendRTSPFrame(const uint8_t* data, size_t len, int quality, int width, int height);  // Defined in rtp.cpp
-
-  void sendRTSPAudio(int16_t* data, size_t len);  // Defined in rtp.cpp
-
-  void sendRTSPSubtitles(char* data, size_t len);  // Defined in rtp.cpp
-
   void startSubtitlesTimer(esp_timer_cb_t userCallback);  // Defined in utils.cpp
 
   bool readyToSendFrame() const;  // Defined in utils.cpp
@@ -94,124 +150,235 @@ public:
 
   bool readyToSendSubtitles() const;  // Defined in utils.cpp
 
+  size_t getAudioRingLevel() const;  // Defined in utils.cpp
+
+  uint32_t getAudioOverruns() const;  // Defined in utils.cpp
+
+  size_t getClientProfileCount();  // Defined in utils.cpp
+
+  bool getClientProfile(size_t index, RTSP_ClientProfile& profile);  // Defined in utils.cpp
+
   bool setCredentials(const char* username, const char* password); // Add method to set credentials
 
+  int8_t addVideoMount(const char* path, uint16_t rtpPort);  // Defined in ESP32-RTSPServer.cpp
+
+  int8_t addAudioMount(const char* path, AudioCodec codec, uint32_t rate, uint16_t rtpPort);  // Defined in ESP32-RTSPServer.cpp
+
+  bool enableBackchannel(AudioCodec codec, uint32_t rate, uint16_t rtpPort);  // Defined in ESP32-RTSPServer.cpp
+
+  size_t readBackchannelAudio(int16_t* samples, size_t count);  // Defined in utils.cpp
+
+  bool getBackchannelStats(RTSP_BackchannelStats& stats);  // Defined in utils.cpp
+
+  uint32_t getCommittedKbps();  // Defined in utils.cpp
+
   uint32_t rtpFps;
   TransportType transport;
   uint32_t sampleRate;
+  AudioCodec audioCodec;
+  uint8_t audioPtime; // Milliseconds of audio per packet, 0 sends each block as it comes
+  SilenceMode silenceMode;
+  uint32_t opusBitrate; // Bits per second of AUDIO_OPUS
+  uint8_t opusComplexity; // Encoder effort of AUDIO_OPUS, 0 to 10
   int rtspPort;
   IPAddress rtpIp;
   uint8_t rtpTTL;
   uint16_t rtpVideoPort;
   uint16_t rtpAudioPort;
   uint16_t rtpSubtitlesPort;
-  uint8_t maxRTSPClients;
+  uint16_t maxRTSPClients;
+  uint32_t bandwidthBudgetKbps; // Uplink budget for viewers, 0 admits by client count only
+  const char* relayUrl; // Where viewers over the budget are sent, or NULL to refuse them
+  bool relayAsProxy; // Redirect with 305 Use Proxy instead of 302
+
+protected:
+  typedef RTSPSubscriberRegistry<MAX_CLIENTS>::List SubscriberList;
+
+  const RTSPMediaCaps caps;
 
-private:
   int rtspSocket;
-  int videoUnicastSocket; 
-  int audioUnicastSocket; 
-  int subtitlesUnicastSocket; 
-  int videoMulticastSocket; 
-  int audioMulticastSocket; 
-  int subtitlesMulticastSocket;
-  uint8_t activeRTSPClients; 
-  uint8_t maxClients;
+  RTSP_Track tracks[RTSP_MAX_TRACKS];  // Registered by init()
+  uint8_t trackCount;
+  int8_t videoTrack;  // Index into tracks, -1 when not streamed
+  int8_t audioTrack;
+  int8_t subtitlesTrack;
+  int8_t backchannelTrack;  // Audio received from clients, -1 when not enabled
+  RTSP_Mount mounts[RTSP_MAX_MOUNTS];  // [0] is the init() stream
+  RTSPRateMeter trackRates[RTSP_MAX_TRACKS];  // Measured by the sending task, read at admission
+  uint8_t mountCount;
+  uint16_t activeRTSPClients; 
+  uint16_t maxClients;
   TaskHandle_t rtpVideoTaskHandle;
+  TaskHandle_t rtpAudioTaskHandle;
   TaskHandle_t rtspTaskHandle;
-  std::map<uint32_t, RTSP_Session> sessions;
-  byte* rtspStreamBuffer;
-  size_t rtspStreamBufferSize;
+  RTSPSessionPool<MAX_CLIENTS> sessions;  // Owned by rtspTask
+  RTSPSubscriberRegistry<MAX_CLIENTS> subscribers;  // Read by the sender tasks
+  RTSPServerEventLoop eventLoop;  // Control sockets, tagged with their session slot
+  RTSPClientProfiles<RTSP_CLIENT_PROFILES> clientProfiles;  // Guarded by profilesMutex
+  std::atomic<uint8_t> firstRtpTracks;  // Tracks just sent to a session awaiting its first packet, taken by rtspTask
+  std::atomic<uint32_t> firstRtpMs;  // When the first of them went out
+  std::atomic<uint32_t> committedKbpsEstimate;  // Refreshed by rtspTask for getCommittedKbps()
+  uint32_t committedRefreshMs;
+  uint32_t rtpIpAddr; // rtpIp in network order, cached for the send path
+  char rtpIpString[16]; // rtpIp as text, cached for multicast SETUP replies
+  RTSPServerAudioRing* audioRing;  // Allocated with the audio task under RTSP_AUDIO_NONBLOCK
+  RTSPAudioFramer audioFramer;  // Cuts audio into audioPtime packets, used by the sending task
+  RTSPAudioClockSync audioClock;  // Holds the audio track's timestamps to the media clock
+  bool audioTalkspurt;  // The next audio packet starts a talkspurt
+  RTSPVoiceDetector voiceDetector;  // Used by the audio sending task with silenceMode
+  bool audioSilent;  // Audio is suppressed until speech resumes
+  uint32_t silentSamples;  // Samples suppressed since the last comfort noise packet
+  const RTSP_PayloadInfo* backchannelFormat;  // Set by enableBackchannel()
+  uint32_t backchannelRate;
+  uint16_t backchannelPort;
+  RTSPServerJitterBuffer* backchannel;  // Filled by rtspTask, read by the sketch under backchannelMutex
+  uint32_t backchannelSsrc;  // Sender the backchannel follows
+  uint32_t backchannelLastMs;  // millis() of its last packet
+  static constexpr uint32_t kBackchannelTakeoverMs = 1000;  // Quiet time before another sender is followed
   bool rtpFrameSent;
   bool rtpAudioSent;
   bool rtpSubtitlesSent;
-  uint8_t vQuality;
-  uint16_t vWidth;
-  uint16_t vHeight;
-  uint16_t videoSequenceNumber;
-  uint32_t videoTimestamp;
-  uint32_t videoSSRC;
-  uint16_t audioSequenceNumber;
-  uint32_t audioTimestamp;
-  uint32_t audioSSRC;
-  uint16_t subtitlesSequenceNumber;
-  uint32_t subtitlesTimestamp;
-  uint32_t subtitlesSSRC;
   uint32_t rtpFrameCount;
   uint32_t lastRtpFPSUpdateTime;
-  uint8_t videoCh;
-  uint8_t audioCh;
-  uint8_t subtitlesCh;
   bool isVideo;
   bool isAudio;
   bool isSubtitles;
   bool isPlaying;
-  bool firstClientConnected; 
-  bool firstClientIsMulticast; 
-  bool firstClientIsTCP;
   bool authEnabled; // Flag to indicate if authentication is enabled
   char base64Credentials[128]; // Store base64 encoded credentials
   esp_timer_handle_t sendSubtitlesTimer;
+  uint32_t sdpSessionId;
+  uint16_t sdpVersion; // Bumped on every rebuild
+  char dateLine[40]; // "Date: ...\r\n", refreshed at most once per second
+  time_t dateLineTime;
   SemaphoreHandle_t isPlayingMutex;  // Mutex for protecting access
   SemaphoreHandle_t sendTcpMutex;  // Mutex for protecting TCP send access
   SemaphoreHandle_t maxClientsMutex; // FreeRTOS mutex for maxClients
+  SemaphoreHandle_t profilesMutex;  // Mutex for clientProfiles
+  SemaphoreHandle_t backchannelMutex;  // Mutex for backchannel
 
   void closeSockets();  // Defined in ESP32-RTSPServer.cpp
+
+  int8_t registerTrack(const RTSP_PayloadInfo& format, const char* control, uint16_t serverPort, uint32_t ssrc, const char* direction = nullptr);  // Defined in ESP32-RTSPServer.cpp
+
+  int8_t findTrack(const RTSP_StringView& url, uint8_t trackMask) const;  // Defined in ESP32-RTSPServer.cpp
+
+  static const RTSP_PayloadInfo& audioFormat(AudioCodec codec);  // Defined in ESP32-RTSPServer.cpp
+
+  bool audioFrameSamples(const RTSP_PayloadInfo& format, uint32_t rate, size_t& frameSamples) const;  // Defined in ESP32-RTSPServer.cpp
+
+  static bool audioRateFits(const RTSP_PayloadInfo& format, uint32_t rate);  // Defined in ESP32-RTSPServer.cpp
+
+  uint8_t audioPtimeFor(const RTSP_PayloadInfo& format) const;  // Defined in ESP32-RTSPServer.cpp
+
+  bool setupAudioTrack(int8_t trackIndex, uint32_t rate);  // Defined in ESP32-RTSPServer.cpp
+
+  bool audioCodecBuilt(AudioCodec codec) const;  // Defined in ESP32-RTSPServer.cpp
+
+  void setupMount(uint8_t index);  // Defined in ESP32-RTSPServer.cpp
+
+  uint8_t extraTracks() const;  // Defined in ESP32-RTSPServer.cpp
+
+  bool reserveTrack(const char* what);  // Defined in ESP32-RTSPServer.cpp
+
+  uint8_t findMount(const RTSP_StringView& url) const;  // Defined in ESP32-RTSPServer.cpp
   
-  void sendTcpPacket(const uint8_t* packet, size_t packetSize, int sock);  // Defined in network.cpp
+  bool sendTcpPacket(const uint8_t* packet, size_t packetSize, const RTSP_Sender& target, bool priority);  // Defined in network.cpp
+
+  bool queueOutput(RTSP_Session& owner, const char* data, size_t len);  // Defined in network.cpp
+
+  bool queuePriority(RTSP_Session& owner, const uint8_t* packet, size_t packetSize);  // Defined in network.cpp
+
+  void allocatePriority(RTSP_Session& owner);  // Defined in network.cpp
+
+  void freePriority(RTSP_Session& owner);  // Defined in network.cpp
+
+  bool flushPriority(RTSP_Session& owner);  // Defined in network.cpp
+
+  bool flushOutput(RTSP_Session& owner);  // Defined in network.cpp
 
   void checkAndSetupUDP(int& rtpSocket, bool isMulticast, uint16_t rtpPort, IPAddress rtpIp = IPAddress());  // Defined in network.cpp
 
-  void sendRtpSubtitles(const char* data, size_t len, int sock, uint16_t sendRtpPort, bool useTCP, bool isMulticast);  // Defined in rtp.cpp
+  void sendRtpDatagram(int rtpSocket, const uint8_t* packet, size_t packetSize, const RTSP_Sender& target, uint16_t sendRtpPort);  // Defined in network.cpp
 
-  void sendRtpAudio(const int16_t* data, size_t len, int sock, uint16_t sendRtpPort, bool useTCP, bool isMulticast);  // Defined in rtp.cpp
+  void readBackchannelSocket();  // Defined in network.cpp
 
-  void sendRtpFrame(const uint8_t* data, size_t len, uint8_t quality, uint16_t width, uint16_t height, int sock, uint16_t sendRtpPort, bool useTCP, bool isMulticast);  // Defined in rtp.cpp
+  void receiveInterleaved(RTSP_Session& session, const uint8_t* frame, size_t len);  // Defined in network.cpp
 
-  static void rtpVideoTaskWrapper(void* pvParameters);  // Defined in rtp.cpp
+  void receiveBackchannel(const uint8_t* rtp, size_t len);  // Defined in network.cpp
 
-  void rtpVideoTask();  // Defined in rtp.cpp
+  virtual void startMediaTasks(bool video, bool audio) = 0;  // Defined in RTSPServerCore.h
 
-  void setMaxClients(uint8_t newMaxClients);  // Defined in utils.cpp
+  virtual bool sendCachedFrame(const RTSP_Sender& target) = 0;  // Defined in RTSPServerCore.h
 
-  uint8_t getMaxClients();  // Defined in utils.cpp
+  void setMaxClients(uint16_t newMaxClients);  // Defined in utils.cpp
 
-  uint8_t getActiveClients();  // Defined in utils.cpp
+  uint16_t getMaxClients();  // Defined in utils.cpp
+
+  uint16_t getActiveClients();  // Defined in utils.cpp
   
   void incrementActiveRTSPClients();  // Defined in utils.cpp
 
   void decrementActiveRTSPClients();  // Defined in utils.cpp
 
-  uint8_t getActiveRTSPClients();  // Defined in utils.cpp
+  uint16_t getActiveRTSPClients();  // Defined in utils.cpp
+
+  uint32_t viewerCostKbps(uint8_t trackMask, bool isTCP) const;  // Defined in utils.cpp
+
+  uint32_t committedKbps(uint8_t& multicastMask);  // Defined in utils.cpp
+
+  bool admitViewer(const RTSP_Session& session, uint8_t trackMask, bool isTCP, bool isMulticast);  // Defined in utils.cpp
+
+  void refuseForBandwidth(RTSP_Session& session);  // Defined in rtsp_requests.cpp
+
+  void refuseClient(const RTSP_Request& request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
   void updateIsPlayingStatus();  // Defined in utils.cpp
+
+  void publishSubscribers();  // Defined in utils.cpp
+
+  void noteFirstRtp(uint8_t trackBit);  // Defined in utils.cpp
+
+  void collectFirstRtp();  // Defined in utils.cpp
+
+  void refreshCommittedKbps();  // Defined in utils.cpp
+
+  void recordFirstRtp(RTSP_Session& session, uint32_t now);  // Defined in utils.cpp
   
   void setIsPlaying(bool playing);  // Defined in utils.cpp
   
   bool getIsPlaying() const;  // Defined in utils.cpp
 
-  int captureCSeq(char* request);  // Defined in utils.cpp
-
   uint32_t generateSessionID();  // Defined in utils.cpp
 
-  uint32_t extractSessionID(char* request);  // Defined in utils.cpp
-
   const char* dateHeader();  // Defined in utils.cpp
 
-  void handleOptions(char* request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
+  void refreshDescribeCache(RTSP_Mount& mount);  // Defined in utils.cpp
+
+  void sendResponse(RTSP_Session& session, const char* data, size_t len);  // Defined in rtsp_requests.cpp
+
+  void sendStatus(RTSP_Session& session, const char* statusLine);  // Defined in rtsp_requests.cpp
 
-  void handleDescribe(RTSP_Session& session);  // Defined in rtsp_requests.cpp
+  void handleOptions(RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
-  void handleSetup(char* request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
+  void handleDescribe(const RTSP_Request& request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
+
+  void handleSetup(const RTSP_Request& request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
   void handlePlay(RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
+  void startPlaying(RTSP_Session& session);  // Defined in rtsp_requests.cpp
+
   void handlePause(RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
   void handleTeardown(RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
   bool handleRTSPRequest(RTSP_Session& session);  // Defined in rtsp_requests.cpp
 
+  bool processInput(RTSP_Session& session);  // Defined in rtsp_requests.cpp
+
+  void handleParsedRequest(const RTSP_Request& request, RTSP_Session& session);  // Defined in rtsp_requests.cpp
+
   bool setNonBlocking(int sockfd);  // Defined in network.cpp
 
   bool prepRTSP();  // Defined in ESP32-RTSPServer.cpp
@@ -220,17 +387,25 @@ private:
 
   void rtspTask();  // Defined in ESP32-RTSPServer.cpp
 
+  void acceptClient();  // Defined in ESP32-RTSPServer.cpp
+
+  void serviceClient(RTSP_Session& session, uint8_t events);  // Defined in ESP32-RTSPServer.cpp
+
+  void watchClient(RTSP_Session& session);  // Defined in ESP32-RTSPServer.cpp
+
+  void closeClient(RTSP_Session& session);  // Defined in ESP32-RTSPServer.cpp
+
   static const char* LOG_TAG;  // Define a log tag for the class
 
   void sendUnauthorizedResponse(RTSP_Session& session); // Add method to send 401 Unauthorized response
-  void extractSessionCookie(const char* buffer, char* sessionCookie, size_t maxLen);
-  bool isBase64Encoded(const char* buffer, size_t length);
-  void handleRTSPCommand(char* command, RTSP_Session& session);
-  bool decodeBase64(const char* input, size_t inputLen, char* output, size_t* outputLen);
-  void wrapInHTTP(char* buffer, size_t len, char* response, size_t maxLen);  // Add this line
-  RTSP_Session* findSessionByCookie(const char* cookie);  // Add this line
+  void handleRTSPCommand(const RTSP_Request& request, RTSP_Session& session);
+  void wrapInHTTP(const char* buffer, size_t len, char* response, size_t maxLen);  // Add this line
 
   friend class LaxRTSPCompat;
 };
 
+#include "RTSPServerCore.h"
+
+typedef RTSPServerCore<RTSPDefaultPolicy> RTSPServer;
+
 #endif // ESP32_RTSP_SERVER_H
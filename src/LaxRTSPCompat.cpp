@@ -4,44 +4,42 @@
 #include "ESP32-RTSPServer.h"
 #include <cstring>
 
-size_t LaxRTSPCompat::buildSdpDescription(const RTSPServer& server, const RTSP_Session& session, char* out, size_t maxLen) {
+size_t LaxRTSPCompat::buildSdpDescription(const RTSPServerBase& server, const RTSP_Mount& mount, const char* localIp, char* out, size_t maxLen) {
   if (!out || maxLen == 0) {
     return 0;
   }
 
   int len = snprintf(out, maxLen,
                      "v=0\r\n"
-                     "o=- %ld 1 IN IP4 %s\r\n"
+                     "o=- %lu %u IN IP4 %s\r\n"
                      "s=\r\n"
                      "c=IN IP4 0.0.0.0\r\n"
                      "t=0 0\r\n"
                      "a=control:*\r\n",
-                     session.sessionID,
-                     WiFi.localIP().toString().c_str());
+                     static_cast<unsigned long>(server.sdpSessionId),
+                     server.sdpVersion,
+                     localIp);
 
-  if (server.isVideo) {
-    len += snprintf(out + len, maxLen - len,
-                    "m=video 0 RTP/AVP 26\r\n"
-                    "a=control:video\r\n");
-  }
-
-  const char* mediaCondition = "sendrecv";
-
-  if (server.isAudio) {
-    len += snprintf(out + len, maxLen - len,
-                    "m=audio 0 RTP/AVP 97\r\n"
-                    "a=rtpmap:97 L16/%lu/1\r\n"
-                    "a=control:audio\r\n"
-                    "a=%s\r\n",
-                    server.sampleRate,
-                    mediaCondition);
-  }
-
-  if (server.isSubtitles) {
-    len += snprintf(out + len, maxLen - len,
-                    "m=text 0 RTP/AVP 98\r\n"
-                    "a=rtpmap:98 t140/1000\r\n"
-                    "a=control:subtitles\r\n");
+  // One media section per track of the mount, described by its payload format
+  for (uint8_t i = 0; i < server.trackCount && len > 0 && static_cast<size_t>(len) < maxLen; i++) {
+    if (!(mount.trackMask & (1 << i))) {
+      continue;
+    }
+    const RTSP_Track& track = server.tracks[i];
+    if (track.comfortNoise) {
+      len += snprintf(out + len, maxLen - len, "m=%s 0 RTP/AVP %u %u\r\n", track.format->media, track.format->payloadType, RTSPAudioSdp::comfortNoisePayloadType(track));
+    } else {
+      len += snprintf(out + len, maxLen - len, "m=%s 0 RTP/AVP %u\r\n", track.format->media, track.format->payloadType);
+    }
+    if (static_cast<size_t>(len) < maxLen) {
+      len += track.format->describe(out + len, maxLen - len, track);
+    }
+    if (static_cast<size_t>(len) < maxLen) {
+      len += snprintf(out + len, maxLen - len, "a=control:%s\r\n", track.control);
+    }
+    if (track.direction && static_cast<size_t>(len) < maxLen) {
+      len += snprintf(out + len, maxLen - len, "a=%s\r\n", track.direction);
+    }
   }
 
   if (len < 0) {
@@ -57,30 +55,27 @@ size_t LaxRTSPCompat::buildSdpDescription(const RTSPServer& server, const RTSP_S
   return finalLen;
 }
 
-void LaxRTSPCompat::ensureDescribe(RTSPServer& server, RTSP_Session& session, const char* reason) {
+void LaxRTSPCompat::ensureDescribe(RTSPServerBase& server, RTSP_Session& session, const char* reason) {
   if (!LaxRTSPSession::shouldSynthesizeDescribe(session.laxState)) {
     return;
   }
 
-  char synthesized[sizeof(session.fallbackSdp)];
-  size_t len = buildSdpDescription(server, session, synthesized, sizeof(synthesized));
+  // The description is shared by all sessions of the mount; just make sure it is current
+  server.refreshDescribeCache(server.mounts[session.mount]);
 
-  if (len > 0) {
-    memcpy(session.fallbackSdp, synthesized, len);
-    session.fallbackSdp[len] = '\0';
-    session.fallbackSdpLen = static_cast<uint16_t>(len);
-    session.hasFallbackSdp = true;
+  LaxRTSPSession::noteDescribe(session.laxState);
+  if (session.laxState.knownQuirks & LaxRTSPSession::SkipsDescribe) {
+    // Expected from this client; not worth a warning every time
+    RTSP_LOGD(RTSPServerBase::LOG_TAG,
+              "Session %u uses fallback DESCRIBE (%s)",
+              session.sessionID,
+              reason ? reason : "automatic");
   } else {
-    session.hasFallbackSdp = false;
-    session.fallbackSdpLen = 0;
-    session.fallbackSdp[0] = '\0';
+    RTSP_LOGW(RTSPServerBase::LOG_TAG,
+              "Session %u triggered fallback DESCRIBE (%s)",
+              session.sessionID,
+              reason ? reason : "automatic");
   }
-
-  LaxRTSPSession::noteDescribe(session.laxState);
-  RTSP_LOGW(RTSPServer::LOG_TAG,
-            "Session %u triggered fallback DESCRIBE (%s)",
-            session.sessionID,
-            reason ? reason : "automatic");
 }
 
 bool LaxRTSPCompat::resumeDeferredPlay(RTSP_Session& session) {
@@ -89,6 +84,44 @@ bool LaxRTSPCompat::resumeDeferredPlay(RTSP_Session& session) {
   }
 
   LaxRTSPSession::clearDeferredPlay(session.laxState);
-  session.isPlaying = true;
   return true;
 }
+
+void LaxRTSPCompat::matchProfile(RTSPServerBase& server, RTSP_Session& session, const RTSP_StringView& userAgent) {
+  if (session.profile >= 0 || userAgent.empty()) {
+    return;
+  }
+
+  uint8_t quirks = 0;
+  if (xSemaphoreTake(server.profilesMutex, portMAX_DELAY) == pdTRUE) {
+    session.profile = server.clientProfiles.match(userAgent.data, userAgent.len);
+    quirks = server.clientProfiles.quirks(session.profile);
+    xSemaphoreGive(server.profilesMutex);
+  }
+
+  LaxRTSPSession::applyProfile(session.laxState, quirks);
+  if (quirks != 0) {
+    RTSP_LOGI(RTSPServerBase::LOG_TAG,
+              "Session %u matches a known lax client (quirks 0x%02x): %.*s",
+              session.sessionID,
+              quirks,
+              static_cast<int>(userAgent.len),
+              userAgent.data);
+  }
+}
+
+void LaxRTSPCompat::learnProfile(RTSPServerBase& server, RTSP_Session& session) {
+  if (session.profile < 0 || !LaxRTSPSession::learnedQuirks(session.laxState)) {
+    return;
+  }
+
+  if (xSemaphoreTake(server.profilesMutex, portMAX_DELAY) == pdTRUE) {
+    server.clientProfiles.learn(session.profile, session.laxState.quirks);
+    xSemaphoreGive(server.profilesMutex);
+  }
+  session.laxState.knownQuirks |= session.laxState.quirks;
+  RTSP_LOGD(RTSPServerBase::LOG_TAG,
+            "Session %u: remembered quirks 0x%02x for its client",
+            session.sessionID,
+            session.laxState.quirks);
+}
@@ -6,11 +6,15 @@
 #include "LaxRTSPSession.h"
 
 struct RTSP_Session;
-class RTSPServer;
+struct RTSP_Mount;
+struct RTSP_StringView;
+class RTSPServerBase;
 
 class LaxRTSPCompat {
 public:
-  static size_t buildSdpDescription(const RTSPServer& server, const RTSP_Session& session, char* out, size_t maxLen);
-  static void ensureDescribe(RTSPServer& server, RTSP_Session& session, const char* reason);
+  static size_t buildSdpDescription(const RTSPServerBase& server, const RTSP_Mount& mount, const char* localIp, char* out, size_t maxLen);
+  static void ensureDescribe(RTSPServerBase& server, RTSP_Session& session, const char* reason);
   static bool resumeDeferredPlay(RTSP_Session& session);
+  static void matchProfile(RTSPServerBase& server, RTSP_Session& session, const RTSP_StringView& userAgent);
+  static void learnProfile(RTSPServerBase& server, RTSP_Session& session);
 };
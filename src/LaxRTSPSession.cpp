@@ -3,12 +3,23 @@
 #include "LaxRTSPSession.h"
 
 namespace {
-bool needsDescribeBefore(const LaxRTSPState& state) {
-  return !(state.didDescribe || state.looseMode);
-}
-
-bool needsSetupBeforePlay(const LaxRTSPState& state) {
-  return !(state.didSetup || state.looseMode);
+// Quirk shown by each request in each phase, indexed by
+// didDescribe | didSetup << 1 | didPlay << 2; 0 where the request is in order
+constexpr uint8_t kQuirkTable[8][3] = {
+  //  Describe                        Setup                           Play
+  {0,                               LaxRTSPSession::SkipsDescribe, LaxRTSPSession::SkipsDescribe | LaxRTSPSession::PlayBeforeSetup},  // Nothing yet
+  {0,                               0,                             LaxRTSPSession::PlayBeforeSetup},                                  // Described
+  {LaxRTSPSession::DescribeLate,    0,                             0},                                                                // Set up without DESCRIBE
+  {LaxRTSPSession::DescribeLate,    0,                             0},                                                                // Described and set up
+  {LaxRTSPSession::DescribeLate,    LaxRTSPSession::SkipsDescribe, LaxRTSPSession::SkipsDescribe | LaxRTSPSession::PlayBeforeSetup},  // Played only
+  {LaxRTSPSession::DescribeLate,    0,                             LaxRTSPSession::PlayBeforeSetup},                                  // Described and played
+  {LaxRTSPSession::DescribeLate,    0,                             0},                                                                // Set up and played
+  {LaxRTSPSession::DescribeLate,    0,                             0},                                                                // All done
+};
+
+uint8_t quirkFor(const LaxRTSPState& state, LaxRTSPSession::RequestType request) {
+  int phase = (state.didDescribe ? 1 : 0) | (state.didSetup ? 2 : 0) | (state.didPlay ? 4 : 0);
+  return kQuirkTable[phase][static_cast<int>(request)];
 }
 }  // namespace
 
@@ -18,28 +29,41 @@ void LaxRTSPSession::reset(LaxRTSPState& state) {
   state.didPlay = false;
   state.looseMode = false;
   state.pendingPlay = false;
+  state.quirks = 0;
+  state.knownQuirks = 0;
 }
 
+/**
+ * Records the quirk the request shows, if any, and switches to lax mode.
+ * Returns true only for behaviour that is unexpected: neither already
+ * allowed by lax mode nor predicted by the client's profile.
+ */
 bool LaxRTSPSession::detectAndEnableLax(LaxRTSPState& state, RequestType request) {
-  bool violation = false;
-
-  switch (request) {
-    case RequestType::Describe:
-      violation = state.didSetup || state.didPlay;
-      break;
-    case RequestType::Setup:
-      violation = needsDescribeBefore(state);
-      break;
-    case RequestType::Play:
-      violation = needsSetupBeforePlay(state);
-      break;
+  uint8_t quirk = quirkFor(state, request);
+  if (quirk == 0) {
+    return false;
   }
 
-  if (violation && !state.looseMode) {
+  state.quirks |= quirk;
+  bool expected = (state.knownQuirks & quirk) == quirk;
+  bool violation = !expected && (request == RequestType::Describe || !state.looseMode);
+  state.looseMode = true;
+  return violation;
+}
+
+/**
+ * Starts a session on the path its client is known to take, so the first
+ * out-of-order request goes straight through.
+ */
+void LaxRTSPSession::applyProfile(LaxRTSPState& state, uint8_t knownQuirks) {
+  state.knownQuirks = knownQuirks;
+  if (knownQuirks & (SkipsDescribe | PlayBeforeSetup)) {
     state.looseMode = true;
   }
+}
 
-  return violation;
+bool LaxRTSPSession::learnedQuirks(const LaxRTSPState& state) {
+  return (state.quirks & ~state.knownQuirks) != 0;
 }
 
 void LaxRTSPSession::noteDescribe(LaxRTSPState& state) {
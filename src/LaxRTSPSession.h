@@ -2,12 +2,16 @@
 
 #pragma once
 
+#include <cstdint>
+
 struct LaxRTSPState {
   bool didDescribe = false;
   bool didSetup = false;
   bool didPlay = false;
   bool looseMode = false;
   bool pendingPlay = false;
+  uint8_t quirks = 0;       // Quirk bits this session has shown
+  uint8_t knownQuirks = 0;  // Quirk bits expected from the client's profile
 };
 
 class LaxRTSPSession {
@@ -18,6 +22,13 @@ public:
     Play,
   };
 
+  // Out-of-order behaviour a client has been seen to show
+  enum Quirk : uint8_t {
+    SkipsDescribe = 0x01,     // SETUP or PLAY without DESCRIBE
+    PlayBeforeSetup = 0x02,   // PLAY before any SETUP
+    DescribeLate = 0x04,      // DESCRIBE after SETUP or PLAY
+  };
+
   static void reset(LaxRTSPState& state);
   static void noteDescribe(LaxRTSPState& state);
   static void noteSetup(LaxRTSPState& state);
@@ -25,6 +36,9 @@ public:
 
   static bool detectAndEnableLax(LaxRTSPState& state, RequestType request);
 
+  static void applyProfile(LaxRTSPState& state, uint8_t knownQuirks);
+  static bool learnedQuirks(const LaxRTSPState& state);
+
   static bool shouldSynthesizeDescribe(const LaxRTSPState& state);
   static bool shouldAllowSetup(const LaxRTSPState& state);
   static bool shouldAllowPlay(const LaxRTSPState& state);
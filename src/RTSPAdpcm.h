@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief IMA/DVI ADPCM encoder, 4 bits per sample, in integer arithmetic.
+ *
+ * The predictor and step index carry over from one call to the next, so a
+ * stream is encoded block by block with no restart at block boundaries.
+ * Samples are packed two per byte with the first one in the high nibble,
+ * as RFC 3551 DVI4 requires.
+ */
+namespace RTSPImaAdpcm {
+static constexpr int16_t kStepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767};
+
+static constexpr int8_t kIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+struct State {
+  int16_t predictor;
+  uint8_t stepIndex;
+};
+
+inline uint8_t encodeSample(State& state, int16_t sample) {
+  int32_t step = kStepTable[state.stepIndex];
+  int32_t diff = static_cast<int32_t>(sample) - state.predictor;
+  uint8_t code = 0;
+  if (diff < 0) {
+    code = 8;
+    diff = -diff;
+  }
+
+  // Three bits of diff/step, building the decoder's delta as we go
+  int32_t delta = step >> 3;
+  if (diff >= step) {
+    code |= 4;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step) {
+    code |= 2;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step) {
+    code |= 1;
+    delta += step;
+  }
+
+  int32_t predictor = state.predictor + ((code & 8) ? -delta : delta);
+  predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+  state.predictor = static_cast<int16_t>(predictor);
+  int32_t index = state.stepIndex + kIndexTable[code];
+  state.stepIndex = static_cast<uint8_t>(index < 0 ? 0 : (index > 88 ? 88 : index));
+  return code;
+}
+
+// Encodes count samples into (count + 1) / 2 bytes; an odd last sample leaves the low nibble 0
+inline void encode(State& state, const int16_t* samples, size_t count, uint8_t* out) {
+  for (size_t i = 0; i + 1 < count; i += 2) {
+    uint8_t high = encodeSample(state, samples[i]);
+    *out++ = static_cast<uint8_t>((high << 4) | encodeSample(state, samples[i + 1]));
+  }
+  if (count & 1) {
+    *out = static_cast<uint8_t>(encodeSample(state, samples[count - 1]) << 4);
+  }
+}
+}  // namespace RTSPImaAdpcm
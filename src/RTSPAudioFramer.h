@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+/**
+ * @brief Cuts a PCM stream into frames of a fixed number of samples.
+ *
+ * Whole frames are handed on straight from the caller's block; only the
+ * samples at the end of a block that do not fill a frame are copied, and
+ * the next block completes them. With a frame size of 0 every block is
+ * handed on as it came.
+ */
+class RTSPAudioFramer {
+public:
+  RTSPAudioFramer() : carry(nullptr), frameSamples(0), carried(0) {}
+
+  ~RTSPAudioFramer() {
+    delete[] this->carry;
+  }
+
+  RTSPAudioFramer(const RTSPAudioFramer&) = delete;
+  RTSPAudioFramer& operator=(const RTSPAudioFramer&) = delete;
+
+  // Sets the frame size and drops anything carried; false if the buffer can not be allocated
+  bool configure(size_t samples) {
+    if (samples != this->frameSamples) {
+      delete[] this->carry;
+      this->carry = samples > 0 ? new (std::nothrow) int16_t[samples] : nullptr;
+      this->frameSamples = this->carry != nullptr ? samples : 0;
+    }
+    this->carried = 0;
+    return samples == this->frameSamples;
+  }
+
+  size_t frameSize() const {
+    return this->frameSamples;
+  }
+
+  // Samples held back for the next frame
+  size_t pending() const {
+    return this->carried;
+  }
+
+  // Calls emit(samples, count) for every frame completed by this block
+  template <class Emit>
+  void push(const int16_t* samples, size_t count, Emit&& emit) {
+    if (this->frameSamples == 0) {
+      if (count > 0) {
+        emit(samples, count);
+      }
+      return;
+    }
+
+    // Complete the frame left over from the previous block
+    if (this->carried > 0) {
+      size_t take = this->frameSamples - this->carried;
+      take = take < count ? take : count;
+      memcpy(this->carry + this->carried, samples, take * sizeof(int16_t));
+      this->carried += take;
+      samples += take;
+      count -= take;
+      if (this->carried < this->frameSamples) {
+        return;
+      }
+      emit(static_cast<const int16_t*>(this->carry), this->frameSamples);
+      this->carried = 0;
+    }
+
+    while (count >= this->frameSamples) {
+      emit(samples, this->frameSamples);
+      samples += this->frameSamples;
+      count -= this->frameSamples;
+    }
+
+    memcpy(this->carry, samples, count * sizeof(int16_t));
+    this->carried = count;
+  }
+
+private:
+  int16_t* carry;
+  size_t frameSamples;
+  size_t carried;
+};
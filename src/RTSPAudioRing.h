@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring of PCM blocks.
+ *
+ * The capture task pushes and the server audio task pops. Neither side ever
+ * waits on the other: a full ring drops the incoming samples and counts an
+ * overrun instead of stalling the I2S read loop.
+ */
+template <size_t Blocks, size_t BlockBytes>
+class RTSPAudioRing {
+public:
+  struct Block {
+    size_t len;  // Bytes of valid PCM in samples
+    int64_t captureUs;  // Media time of the first sample, 0 for the later parts of a split block
+    int16_t samples[BlockBytes / sizeof(int16_t)];
+  };
+
+  RTSPAudioRing() : head(0), tail(0), overrunCount(0) {}
+
+  // Producer side. Blocks larger than BlockBytes are split across slots.
+  bool push(const int16_t* data, size_t len, int64_t captureUs) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    while (len > 0) {
+      uint32_t h = this->head.load(std::memory_order_relaxed);
+      if (h - this->tail.load(std::memory_order_acquire) >= Blocks) {
+        this->overrunCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      Block& block = this->blocks[h % Blocks];
+      size_t chunk = len < BlockBytes ? len : BlockBytes;
+      memcpy(block.samples, src, chunk);
+      block.len = chunk;
+      block.captureUs = captureUs;
+      captureUs = 0;
+      this->head.store(h + 1, std::memory_order_release);
+      src += chunk;
+      len -= chunk;
+    }
+    return true;
+  }
+
+  // Consumer side: returns the oldest block or nullptr when empty.
+  const Block* front() const {
+    uint32_t t = this->tail.load(std::memory_order_relaxed);
+    if (t == this->head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &this->blocks[t % Blocks];
+  }
+
+  void pop() {
+    this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  size_t level() const {
+    return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+  }
+
+  uint32_t overruns() const {
+    return this->overrunCount.load(std::memory_order_relaxed);
+  }
+
+private:
+  Block blocks[Blocks];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> overrunCount;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace RTSPBandwidth {
+// IPv4 and UDP headers a packet carries on the wire besides the RTP packet
+static constexpr uint32_t kUdpIpOverhead = 28;
+}  // namespace RTSPBandwidth
+
+/**
+ * @brief Bit rate of one track, measured over windows of at least a second.
+ *
+ * Written by the task that sends the track and read by the RTSP task for
+ * admission. The last measurement is kept while nobody watches, so the next
+ * viewer is weighed against what the stream really costs.
+ */
+class RTSPRateMeter {
+public:
+  RTSPRateMeter() : windowStart(0), windowBytes(0), rate(0), started(false) {}
+
+  void reset() {
+    this->windowBytes = 0;
+    this->rate = 0;
+    this->started = false;
+  }
+
+  void add(uint32_t bytes, uint32_t nowMs) {
+    if (!this->started) {
+      this->windowStart = nowMs;
+      this->started = true;
+    }
+    this->windowBytes += bytes;
+    uint32_t elapsed = nowMs - this->windowStart;
+    if (elapsed >= 1000) {
+      // Bits per millisecond is kbit/s
+      uint32_t measured = static_cast<uint32_t>((static_cast<uint64_t>(this->windowBytes) * 8) / elapsed);
+      this->rate = this->rate == 0 ? measured : (this->rate + measured) / 2;
+      this->windowStart = nowMs;
+      this->windowBytes = 0;
+    }
+  }
+
+  // Smoothed rate in kbit/s, 0 until a full window was seen
+  uint32_t kbps() const {
+    return this->rate;
+  }
+
+private:
+  uint32_t windowStart;
+  uint32_t windowBytes;
+  volatile uint32_t rate;
+  bool started;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sextet value per input character; whitespace, padding and anything else
+// get marker values above 63
+namespace RTSPBase64 {
+static constexpr uint8_t kPad = 0xFD;
+static constexpr uint8_t kSkip = 0xFE;
+static constexpr uint8_t kInvalid = 0xFF;
+
+static constexpr uint8_t kValues[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0xFE, 0xFF, 0xFF, 0xFE, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 62, 0xFF, 0xFF, 0xFF, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 0xFF, 0xFF, 0xFF, 0xFD, 0xFF, 0xFF,
+  0xFF, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+}  // namespace RTSPBase64
+
+/**
+ * @brief Streaming base64 decoder for the POST side of an HTTP tunnel.
+ *
+ * Bits of an unfinished quantum are kept between calls, so input can be fed
+ * in whatever pieces TCP delivers it. Whitespace is skipped and padding
+ * closes the current quantum. Whole quanta go through a table lookup per
+ * character with no branches on the character class.
+ *
+ * Decoding in place is safe when the output starts at least kInPlaceGap
+ * bytes before the input.
+ */
+class RTSPBase64Decoder {
+public:
+  static constexpr size_t kInPlaceGap = 1;
+
+  RTSPBase64Decoder() : bits(0), bitCount(0) {}
+
+  void reset() {
+    this->bits = 0;
+    this->bitCount = 0;
+  }
+
+  /**
+   * @brief Decodes len characters from in to out.
+   *
+   * @return Bytes written, or -1 on a character outside the base64 alphabet.
+   */
+  int decode(const char* in, size_t len, char* out) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(in);
+    char* start = out;
+    size_t i = 0;
+    while (i < len) {
+      if (this->bitCount == 0) {
+        // Four characters to three bytes while nothing special turns up
+        while (i + 4 <= len) {
+          uint32_t a = RTSPBase64::kValues[src[i]];
+          uint32_t b = RTSPBase64::kValues[src[i + 1]];
+          uint32_t c = RTSPBase64::kValues[src[i + 2]];
+          uint32_t d = RTSPBase64::kValues[src[i + 3]];
+          if ((a | b | c | d) & kSpecial) {
+            break;
+          }
+          uint32_t word = (a << 18) | (b << 12) | (c << 6) | d;
+          out[0] = static_cast<char>(word >> 16);
+          out[1] = static_cast<char>(word >> 8);
+          out[2] = static_cast<char>(word);
+          out += 3;
+          i += 4;
+        }
+        if (i == len) {
+          break;
+        }
+      }
+
+      uint8_t value = RTSPBase64::kValues[src[i++]];
+      if (value == kSkip) {
+        continue;
+      }
+      if (value == kPad) {
+        reset();  // Any whole bytes of the quantum are already out
+        continue;
+      }
+      if (value == kInvalid) {
+        return -1;
+      }
+      this->bits = (this->bits << 6) | value;
+      this->bitCount += 6;
+      if (this->bitCount >= 8) {
+        this->bitCount -= 8;
+        *out++ = static_cast<char>(this->bits >> this->bitCount);
+        this->bits &= (1u << this->bitCount) - 1;
+      }
+    }
+    return static_cast<int>(out - start);
+  }
+
+private:
+  static constexpr uint8_t kSpecial = 0xC0;  // Set in every non-alphabet entry
+  static constexpr uint8_t kPad = RTSPBase64::kPad;
+  static constexpr uint8_t kSkip = RTSPBase64::kSkip;
+  static constexpr uint8_t kInvalid = RTSPBase64::kInvalid;
+
+  uint32_t bits;
+  uint8_t bitCount;
+};
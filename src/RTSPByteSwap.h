@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Little-endian 16-bit samples to network byte order.
+ *
+ * When source and destination share their alignment, two samples are swapped
+ * per 32-bit word with two masks and two shifts; the host compiler turns the
+ * same loop into SIMD shuffles. Anything left over goes sample by sample.
+ */
+namespace RTSPByteSwap {
+typedef uint32_t __attribute__((may_alias)) Word;
+
+inline void swapSample(uint8_t* dst, int16_t sample) {
+  dst[0] = (sample >> 8) & 0xFF; // High byte
+  dst[1] = sample & 0xFF; // Low byte
+}
+
+// Writes count samples to dst in network order; dst may be src itself
+inline void toNetwork16(uint8_t* dst, const int16_t* src, size_t count) {
+  size_t i = 0;
+  if (((reinterpret_cast<uintptr_t>(dst) ^ reinterpret_cast<uintptr_t>(src)) & 3) == 0) {
+    if ((reinterpret_cast<uintptr_t>(src) & 3) != 0 && count > 0) {
+      swapSample(dst, src[0]);
+      i = 1;
+    }
+    const Word* in = reinterpret_cast<const Word*>(src + i);
+    Word* out = reinterpret_cast<Word*>(dst + 2 * i);
+    size_t words = (count - i) / 2;
+    for (size_t w = 0; w < words; w++) {
+      uint32_t v = in[w];
+      out[w] = ((v & 0x00FF00FFu) << 8) | ((v >> 8) & 0x00FF00FFu);
+    }
+    i += 2 * words;
+  }
+  for (; i < count; i++) {
+    swapSample(dst + 2 * i, src[i]);
+  }
+}
+}  // namespace RTSPByteSwap
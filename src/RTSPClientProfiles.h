@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define RTSP_CLIENT_AGENT_LENGTH 32 // User-Agent prefix kept for reporting
+
+/**
+ * @brief What the server has learned about one kind of client.
+ */
+struct RTSP_ClientProfile {
+  char userAgent[RTSP_CLIENT_AGENT_LENGTH];  // Truncated User-Agent
+  uint8_t quirks;            // LaxRTSPSession::Quirk bits seen from this client
+  uint32_t sessions;         // Sessions matched to this profile
+  uint32_t firstRtpSamples;  // Sessions that got as far as their first RTP packet
+  uint32_t firstRtpTotalMs;  // Sum of accept-to-first-RTP times
+  uint32_t firstRtpLastMs;
+  uint32_t firstRtpMaxMs;
+
+  uint32_t averageFirstRtpMs() const {
+    return this->firstRtpSamples > 0 ? this->firstRtpTotalMs / this->firstRtpSamples : 0;
+  }
+};
+
+/**
+ * @brief Fixed-size table of client profiles keyed by User-Agent.
+ *
+ * Profiles remember the lax-mode quirks a client has shown, so the next
+ * session from the same client starts on the right path, and collect
+ * accept-to-first-RTP times per client. When the table is full the least
+ * recently matched profile no session holds is reused; sessions keep their
+ * index until they release() it, so it always names their own client.
+ */
+template <size_t Capacity>
+class RTSPClientProfiles {
+  static_assert(Capacity > 0 && Capacity < 128, "Profile indexes must fit in int8_t");
+
+public:
+  RTSPClientProfiles() : count(0), clock(0) {
+    memset(this->profiles, 0, sizeof(this->profiles));
+    memset(this->hashes, 0, sizeof(this->hashes));
+    memset(this->lastUsed, 0, sizeof(this->lastUsed));
+    memset(this->holders, 0, sizeof(this->holders));
+  }
+
+  // Index of the profile for the agent, created if new; -1 if every profile is held. Pair with release()
+  int8_t match(const char* agent, size_t len) {
+    uint32_t hash = agentHash(agent, len);
+    size_t n = len < RTSP_CLIENT_AGENT_LENGTH - 1 ? len : RTSP_CLIENT_AGENT_LENGTH - 1;
+    this->clock++;
+    for (size_t i = 0; i < this->count; i++) {
+      // The hash covers the whole agent, the stored prefix rules out collisions between different ones
+      if (this->hashes[i] == hash && strlen(this->profiles[i].userAgent) == n && memcmp(this->profiles[i].userAgent, agent, n) == 0) {
+        this->lastUsed[i] = this->clock;
+        this->holders[i]++;
+        this->profiles[i].sessions++;
+        return static_cast<int8_t>(i);
+      }
+    }
+
+    size_t slot = this->count;
+    if (slot < Capacity) {
+      this->count++;
+    } else {
+      slot = Capacity;
+      for (size_t i = 0; i < Capacity; i++) {
+        if (this->holders[i] == 0 && (slot == Capacity || this->lastUsed[i] < this->lastUsed[slot])) {
+          slot = i;
+        }
+      }
+      if (slot == Capacity) {
+        return -1;
+      }
+    }
+
+    RTSP_ClientProfile& profile = this->profiles[slot];
+    memset(&profile, 0, sizeof(profile));
+    memcpy(profile.userAgent, agent, n);
+    profile.sessions = 1;
+    this->hashes[slot] = hash;
+    this->lastUsed[slot] = this->clock;
+    this->holders[slot] = 1;
+    return static_cast<int8_t>(slot);
+  }
+
+  // Called when a session that matched the profile ends
+  void release(int8_t index) {
+    if (index >= 0 && this->holders[index] > 0) {
+      this->holders[index]--;
+    }
+  }
+
+  uint8_t quirks(int8_t index) const {
+    return index >= 0 ? this->profiles[index].quirks : 0;
+  }
+
+  void learn(int8_t index, uint8_t quirks) {
+    if (index >= 0) {
+      this->profiles[index].quirks |= quirks;
+    }
+  }
+
+  void recordFirstRtp(int8_t index, uint32_t elapsedMs) {
+    if (index < 0) {
+      return;
+    }
+    RTSP_ClientProfile& profile = this->profiles[index];
+    profile.firstRtpSamples++;
+    profile.firstRtpTotalMs += elapsedMs;
+    profile.firstRtpLastMs = elapsedMs;
+    if (elapsedMs > profile.firstRtpMaxMs) {
+      profile.firstRtpMaxMs = elapsedMs;
+    }
+  }
+
+  const RTSP_ClientProfile* get(size_t index) const {
+    return index < this->count ? &this->profiles[index] : nullptr;
+  }
+
+  size_t size() const {
+    return this->count;
+  }
+
+private:
+  // FNV-1a
+  static uint32_t agentHash(const char* agent, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+      hash = (hash ^ static_cast<uint8_t>(agent[i])) * 16777619u;
+    }
+    return hash;
+  }
+
+  RTSP_ClientProfile profiles[Capacity];
+  uint32_t hashes[Capacity];
+  uint32_t lastUsed[Capacity];
+  uint16_t holders[Capacity];  // Live sessions matched to the profile; held profiles are not reused
+  size_t count;
+  uint32_t clock;
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// epoll where the platform has it (host builds), poll() everywhere else
+#if !defined(ESP_PLATFORM) && defined(__has_include)
+  #if __has_include(<sys/epoll.h>)
+    #define RTSP_EVENT_LOOP_EPOLL
+  #endif
+#endif
+
+#ifdef RTSP_EVENT_LOOP_EPOLL
+  #include <sys/epoll.h>
+#else
+  #include <sys/poll.h>
+#endif
+
+/**
+ * @brief Readiness loop for the RTSP control sockets.
+ *
+ * Every socket is registered with a tag (the session's pool slot, or
+ * kListener for the accept socket, kMedia for the backchannel) that comes back with its events, so a
+ * ready socket leads straight to its session without any lookup. Nothing is
+ * rebuilt per iteration; sockets are added on accept and removed on close.
+ * The poll() build finds a socket's entry from its tag too, so watch() and
+ * remove() cost the same however many connections are open.
+ * Write interest is only turned on while a connection has output queued.
+ *
+ * Other tasks interrupt a wait with wake(), which sends a byte to a
+ * loopback UDP socket the loop watches; the handler then gets kWakeup.
+ */
+template <size_t Capacity>
+class RTSPEventLoop {
+public:
+  static constexpr uint16_t kListener = 0xFFFF;
+  static constexpr uint16_t kMedia = 0xFFFE;  // A media socket the server receives on
+  static constexpr uint16_t kWakeup = 0xFFFD;  // wake() was called
+
+  // Event bits passed to the handler and to watch()
+  static constexpr uint8_t kReadable = 0x01;
+  static constexpr uint8_t kWritable = 0x02;
+  static constexpr uint8_t kHangup = 0x04;  // Reported whatever the interest
+
+  RTSPEventLoop() : wakeSock(-1) {
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    this->epollFd = -1;
+#else
+    this->count = 0;
+#endif
+  }
+
+  ~RTSPEventLoop() {
+    end();
+  }
+
+  bool begin(int listenSock) {
+    end();
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    this->epollFd = epoll_create1(0);
+    if (this->epollFd < 0) {
+      return false;
+    }
+#endif
+    return add(listenSock, kListener) && openWakeup();
+  }
+
+  // Makes the next or current wait() return with kWakeup; callable from any task
+  void wake() {
+    if (this->wakeSock >= 0) {
+      uint8_t byte = 0;
+      send(this->wakeSock, &byte, 1, MSG_DONTWAIT);
+    }
+  }
+
+  void end() {
+    if (this->wakeSock >= 0) {
+      close(this->wakeSock);
+      this->wakeSock = -1;
+    }
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    if (this->epollFd >= 0) {
+      close(this->epollFd);
+      this->epollFd = -1;
+    }
+#else
+    this->count = 0;
+#endif
+  }
+
+  bool add(int sock, uint16_t tag) {
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    return epoll_ctl(this->epollFd, EPOLL_CTL_ADD, sock, &event) == 0;
+#else
+    if (this->count >= Capacity + 2 || (tag < kWakeup && tag >= Capacity)) {
+      return false;
+    }
+    this->fds[this->count].fd = sock;
+    this->fds[this->count].events = POLLIN;
+    this->fds[this->count].revents = 0;
+    this->tags[this->count] = tag;
+    this->positions[keyOf(tag)] = static_cast<uint16_t>(this->count);
+    this->count++;
+    return true;
+#endif
+  }
+
+  // Replaces the events a registered socket is watched for
+  void watch(int sock, uint16_t tag, uint8_t events) {
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    struct epoll_event event = {};
+    event.events = ((events & kReadable) ? static_cast<uint32_t>(EPOLLIN) : 0u) | ((events & kWritable) ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u32 = tag;
+    epoll_ctl(this->epollFd, EPOLL_CTL_MOD, sock, &event);
+#else
+    size_t i = this->positions[keyOf(tag)];
+    if (i < this->count && this->fds[i].fd == sock) {
+      this->fds[i].events = ((events & kReadable) ? POLLIN : 0) | ((events & kWritable) ? POLLOUT : 0);
+    }
+#endif
+  }
+
+  // Unregisters a socket added with tag
+  void remove(int sock, uint16_t tag) {
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    (void)tag;
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, sock, nullptr);
+#else
+    size_t i = this->positions[keyOf(tag)];
+    if (i >= this->count || this->fds[i].fd != sock) {
+      return;
+    }
+    // Order does not matter, so fill the gap with the last entry
+    this->count--;
+    this->fds[i] = this->fds[this->count];
+    this->tags[i] = this->tags[this->count];
+    this->positions[keyOf(this->tags[i])] = static_cast<uint16_t>(i);
+#endif
+  }
+
+  /**
+   * @brief Waits for ready sockets and calls handler(tag, events) for each one.
+   *
+   * The handler may add or remove sockets; ready tags are collected first.
+   * @return Number of ready sockets, or -1 on error.
+   */
+  template <class Handler>
+  int wait(int timeoutMs, Handler&& handler) {
+#ifdef RTSP_EVENT_LOOP_EPOLL
+    struct epoll_event events[kMaxEvents];
+    int ready = epoll_wait(this->epollFd, events, kMaxEvents, timeoutMs);
+    for (int i = 0; i < ready; i++) {
+      if (events[i].data.u32 == kWakeup) {
+        drainWakeup();
+      }
+      uint32_t e = events[i].events;
+      uint8_t flags = ((e & EPOLLIN) ? kReadable : 0) | ((e & EPOLLOUT) ? kWritable : 0) | ((e & (EPOLLHUP | EPOLLERR)) ? kHangup : 0);
+      handler(static_cast<uint16_t>(events[i].data.u32), flags);
+    }
+    return ready;
+#else
+    int ready = poll(this->fds, this->count, timeoutMs);
+    if (ready <= 0) {
+      return ready;
+    }
+    size_t readyCount = 0;
+    for (size_t i = 0; i < this->count && readyCount < static_cast<size_t>(ready); i++) {
+      short e = this->fds[i].revents;
+      if (e != 0) {
+        this->readyEvents[readyCount] = ((e & POLLIN) ? kReadable : 0) | ((e & POLLOUT) ? kWritable : 0) | ((e & (POLLHUP | POLLERR | POLLNVAL)) ? kHangup : 0);
+        this->readyTags[readyCount++] = this->tags[i];
+      }
+    }
+    for (size_t i = 0; i < readyCount; i++) {
+      if (this->readyTags[i] == kWakeup) {
+        drainWakeup();
+      }
+      handler(this->readyTags[i], this->readyEvents[i]);
+    }
+    return ready;
+#endif
+  }
+
+private:
+  // A UDP socket connected to itself on loopback, as lwIP has no pipes
+  bool openWakeup() {
+    this->wakeSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (this->wakeSock < 0) {
+      return false;
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (bind(this->wakeSock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(this->wakeSock, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) != 0 ||
+        connect(this->wakeSock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        !add(this->wakeSock, kWakeup)) {
+      close(this->wakeSock);
+      this->wakeSock = -1;
+      return false;
+    }
+    return true;
+  }
+
+  // Wakes that pile up before the loop runs are handled once
+  void drainWakeup() {
+    uint8_t bytes[16];
+    while (recv(this->wakeSock, bytes, sizeof(bytes), MSG_DONTWAIT) > 0) {
+    }
+  }
+
+#ifndef RTSP_EVENT_LOOP_EPOLL
+  // Index into positions[]: slot tags map to themselves, kWakeup, kMedia and kListener follow them
+  static size_t keyOf(uint16_t tag) {
+    return tag >= kWakeup ? Capacity + (tag - kWakeup) : tag;
+  }
+#endif
+
+  int wakeSock;
+#ifdef RTSP_EVENT_LOOP_EPOLL
+  static constexpr int kMaxEvents = 16;
+  int epollFd;
+#else
+  // Capacity sockets plus the listener and the wakeup socket
+  struct pollfd fds[Capacity + 2];
+  uint16_t tags[Capacity + 2];
+  uint16_t readyTags[Capacity + 2];
+  uint8_t readyEvents[Capacity + 2];
+  uint16_t positions[Capacity + 3];  // Entry in fds[] of each tag, by keyOf()
+  size_t count;
+#endif
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include "RTSPPayloadFormat.h"
+
+/**
+ * @brief One cached video frame and the RTP state it was sent with.
+ */
+struct RTSP_CachedFrame {
+  uint8_t* data;
+  size_t capacity;  // Bytes allocated for data; grows to the largest frame seen
+  size_t len;
+  uint8_t quality;
+  uint16_t width;
+  uint16_t height;
+  uint32_t timestamp;  // Capture time on the video RTP clock, applied when the frame is sent
+  RTSP_StreamState stream;  // RTP state the frame was sent with
+  std::atomic<uint8_t> refs;
+};
+
+/**
+ * @brief Keeps the most recent video frame for sessions that start playing.
+ *
+ * Frames live in a few refcounted slots. The writer claims a free slot, fills
+ * it and publishes it as current; readers take a reference to the current
+ * frame and send straight from it, so a frame is never copied twice and a
+ * slow reader never blocks the writer. The cache itself holds one reference
+ * on the current frame.
+ */
+template <size_t Slots>
+class RTSPFrameCache {
+  static_assert(Slots >= 3, "Need slots for the current frame, one reader and the writer");
+
+public:
+  typedef void* (*ReallocFn)(void* ptr, size_t size);
+
+  explicit RTSPFrameCache(ReallocFn reallocFn = realloc) : reallocFn(reallocFn), current(nullptr) {
+    for (size_t i = 0; i < Slots; i++) {
+      this->frames[i].data = nullptr;
+      this->frames[i].capacity = 0;
+      this->frames[i].len = 0;
+      this->frames[i].refs.store(0);
+    }
+  }
+
+  // Changes where slots are allocated; only before the first frame
+  void setAllocator(ReallocFn fn) {
+    this->reallocFn = fn;
+  }
+
+  /**
+   * @brief Claims a free slot with room for len bytes.
+   *
+   * @return The slot, owned by the caller until publish() or abandon(), or
+   *         nullptr if every slot is in use or the allocation failed.
+   */
+  RTSP_CachedFrame* beginWrite(size_t len) {
+    for (size_t i = 0; i < Slots; i++) {
+      RTSP_CachedFrame& frame = this->frames[i];
+      uint8_t expected = 0;
+      if (!frame.refs.compare_exchange_strong(expected, 1)) {
+        continue;
+      }
+      if (frame.capacity < len) {
+        uint8_t* grown = static_cast<uint8_t*>(this->reallocFn(frame.data, len));
+        if (grown == nullptr) {
+          frame.refs.store(0);
+          return nullptr;
+        }
+        frame.data = grown;
+        frame.capacity = len;
+      }
+      return &frame;
+    }
+    return nullptr;
+  }
+
+  // Makes a claimed frame the current one; the caller's claim becomes the cache's reference
+  void publish(RTSP_CachedFrame* frame) {
+    RTSP_CachedFrame* old = this->current.exchange(frame);
+    if (old != nullptr) {
+      release(old);
+    }
+  }
+
+  void abandon(RTSP_CachedFrame* frame) {
+    release(frame);
+  }
+
+  // The current frame with a reference taken, or nullptr before the first frame
+  RTSP_CachedFrame* acquire() {
+    while (true) {
+      RTSP_CachedFrame* frame = this->current.load();
+      if (frame == nullptr) {
+        return nullptr;
+      }
+      frame->refs.fetch_add(1);
+      if (this->current.load() == frame) {
+        return frame;
+      }
+      // Replaced in between; the slot may be refilled, so try again
+      release(frame);
+    }
+  }
+
+  void release(RTSP_CachedFrame* frame) {
+    frame->refs.fetch_sub(1);
+  }
+
+  // Frees every slot. Only call when no task can be using the cache.
+  void reset() {
+    this->current.store(nullptr);
+    for (size_t i = 0; i < Slots; i++) {
+      free(this->frames[i].data);
+      this->frames[i].data = nullptr;
+      this->frames[i].capacity = 0;
+      this->frames[i].len = 0;
+      this->frames[i].refs.store(0);
+    }
+  }
+
+private:
+  ReallocFn reallocFn;
+  RTSP_CachedFrame frames[Slots];
+  std::atomic<RTSP_CachedFrame*> current;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief G.711 µ-law and A-law encoders and decoders (ITU-T G.711).
+ *
+ * The segment of a sample comes from one 256-entry table indexed by its top
+ * magnitude bits; sign handling and clipping are done with masks, so
+ * encoding a block is a straight loop with no data-dependent branches.
+ * Output matches the ITU reference code for every 16-bit input.
+ */
+namespace RTSPG711 {
+// floor(log2(i)) for i >= 2, 0 for 0 and 1: the segment of a magnitude
+static constexpr uint8_t kSegments[256] = {
+  0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7};
+
+// In the 14-bit domain of the G.711 reference code. Clipping one below
+// its 8159 gives the same top code and keeps the table index in range.
+static constexpr int32_t kUlawBias = 0x21;
+static constexpr int32_t kUlawClip = 8158;
+
+inline uint8_t encodeUlaw(int16_t sample) {
+  int32_t s = sample >> 2;
+  int32_t signMask = s >> 31;  // -1 for negative samples
+  int32_t magnitude = (s ^ signMask) - signMask;
+  magnitude = (magnitude < kUlawClip ? magnitude : kUlawClip) + kUlawBias;
+  uint8_t segment = kSegments[magnitude >> 5];
+  uint8_t mantissa = (magnitude >> (segment + 1)) & 0x0F;
+  uint8_t sign = static_cast<uint8_t>(signMask & 0x80);
+  return static_cast<uint8_t>(~(sign | (segment << 4) | mantissa));
+}
+
+inline uint8_t encodeAlaw(int16_t sample) {
+  int32_t s = sample;
+  int32_t signMask = s >> 31;
+  int32_t magnitude = (s ^ signMask) >> 3;  // One's complement for negatives, 12 bits
+  uint8_t segment = kSegments[magnitude >> 4];
+  uint8_t mantissa = (magnitude >> (segment + (segment == 0))) & 0x0F;
+  uint8_t invert = static_cast<uint8_t>(0xD5 ^ (signMask & 0x80));
+  return static_cast<uint8_t>(((segment << 4) | mantissa) ^ invert);
+}
+
+// Decoders, for audio received on a backchannel
+inline int16_t decodeUlaw(uint8_t code) {
+  code = ~code;
+  int32_t magnitude = (((code & 0x0F) << 3) + 0x84) << ((code & 0x70) >> 4);
+  return static_cast<int16_t>((code & 0x80) ? 0x84 - magnitude : magnitude - 0x84);
+}
+
+inline int16_t decodeAlaw(uint8_t code) {
+  code ^= 0x55;
+  int32_t magnitude = (code & 0x0F) << 4;
+  uint8_t segment = (code & 0x70) >> 4;
+  magnitude += segment == 0 ? 8 : 0x108;
+  if (segment > 1) {
+    magnitude <<= segment - 1;
+  }
+  return static_cast<int16_t>((code & 0x80) ? magnitude : -magnitude);
+}
+}  // namespace RTSPG711
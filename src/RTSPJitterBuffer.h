@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Receive statistics of a backchannel.
+ */
+struct RTSP_BackchannelStats {
+  uint32_t packets;    // Packets received
+  uint32_t lost;       // Packets that never arrived
+  uint32_t late;       // Packets that arrived after their playout time and were dropped
+  uint32_t concealed;  // Samples filled in for missing audio
+  uint32_t skipped;    // Samples dropped to bring the delay back down
+  uint32_t underruns;  // Times playout ran dry and waited to refill
+  uint16_t jitterMs;   // RFC 3550 interarrival jitter
+  uint16_t delayMs;    // Audio buffered ahead of playout
+  uint16_t targetMs;   // Delay the buffer aims for
+};
+
+/**
+ * @brief Adaptive jitter buffer for one received audio stream.
+ *
+ * Packets are stored by RTP timestamp and played out by a reader that pulls
+ * at its own steady rate, e.g. the I2S speaker. Playout starts once the
+ * buffered audio reaches a target delay that follows the measured jitter
+ * between the configured limits; it skips ahead when the delay grows well
+ * past the target and refills after running dry. Gaps left by lost packets
+ * are concealed by repeating the last audio played with fading gain.
+ */
+template <size_t Slots, size_t MaxSamples>
+class RTSPJitterBuffer {
+public:
+  RTSPJitterBuffer() : clockRate(8000), minDelay(160), maxDelay(1600) {
+    reset();
+  }
+
+  void configure(uint32_t rate, uint16_t minDelayMs, uint16_t maxDelayMs) {
+    this->clockRate = rate;
+    this->minDelay = rate * minDelayMs / 1000;
+    this->maxDelay = rate * maxDelayMs / 1000;
+    reset();
+  }
+
+  // Forgets the stream, e.g. when another sender takes over
+  void reset() {
+    for (size_t i = 0; i < Slots; i++) {
+      this->slots[i].used = false;
+    }
+    this->playing = false;
+    this->started = false;
+    this->playTs = 0;
+    this->highestSeq = 0;
+    this->lastTransit = 0;
+    this->jitterQ4 = 0;
+    this->packetSamples = 0;
+    this->concealLen = 0;
+    this->concealPos = 0;
+    this->concealGain = 0;
+  }
+
+  /**
+   * @brief Stores a packet of count samples; decode(dst) writes them.
+   *
+   * @param arrivalMs millis() when the packet arrived, for the jitter estimate.
+   * @return false if the packet came too late or does not fit a slot.
+   */
+  template <class Decode>
+  bool push(uint16_t seq, uint32_t timestamp, uint32_t arrivalMs, size_t count, Decode&& decode) {
+    if (count == 0 || count > MaxSamples) {
+      return false;
+    }
+    this->counters.packets++;
+
+    // RFC 3550 interarrival jitter, in timestamp units scaled by 16
+    uint32_t transit = static_cast<uint32_t>(static_cast<uint64_t>(arrivalMs) * this->clockRate / 1000) - timestamp;
+    if (this->started) {
+      int32_t d = static_cast<int32_t>(transit - this->lastTransit);
+      uint32_t magnitude = d < 0 ? -d : d;
+      this->jitterQ4 += magnitude - ((this->jitterQ4 + 8) >> 4);
+
+      int16_t ahead = static_cast<int16_t>(seq - this->highestSeq);
+      if (ahead > 0) {
+        this->counters.lost += ahead - 1;
+        this->highestSeq = seq;
+      } else if (this->counters.lost > 0) {
+        this->counters.lost--;  // Reordered; it was counted as lost
+      }
+    } else {
+      this->highestSeq = seq;
+      this->started = true;
+    }
+    this->lastTransit = transit;
+    this->packetSamples = static_cast<uint32_t>(count);
+
+    if (this->playing && static_cast<int32_t>(timestamp + count - this->playTs) <= 0) {
+      this->counters.late++;
+      return false;
+    }
+
+    // Take a free slot, or the one holding the oldest audio
+    Slot* slot = nullptr;
+    for (size_t i = 0; i < Slots && slot == nullptr; i++) {
+      if (!this->slots[i].used) {
+        slot = &this->slots[i];
+      }
+    }
+    if (slot == nullptr) {
+      slot = oldest();
+    }
+    slot->used = true;
+    slot->timestamp = timestamp;
+    slot->count = static_cast<uint16_t>(count);
+    decode(slot->samples);
+    return true;
+  }
+
+  /**
+   * @brief Fills out with the next count samples of the stream.
+   *
+   * Always fills all of out: before playout starts and while refilling it
+   * gets silence, and gaps get concealment.
+   *
+   * @return Samples that came from received packets.
+   */
+  size_t pull(int16_t* out, size_t count) {
+    if (!this->playing && !startPlayout()) {
+      memset(out, 0, count * sizeof(int16_t));
+      return 0;
+    }
+
+    // Skip ahead when far more is buffered than the target, e.g. after a burst
+    uint32_t buffered = bufferedSamples();
+    uint32_t target = targetSamples();
+    if (buffered > target + target / 2 + this->packetSamples) {
+      uint32_t skip = buffered - target;
+      this->counters.skipped += skip;
+      this->playTs += skip;
+    }
+
+    size_t done = 0;
+    size_t real = 0;
+    while (done < count) {
+      Slot* slot = slotAt(this->playTs);
+      if (slot != nullptr) {
+        size_t offset = this->playTs - slot->timestamp;
+        size_t take = slot->count - offset;
+        take = take < count - done ? take : count - done;
+        memcpy(out + done, slot->samples + offset, take * sizeof(int16_t));
+        remember(out + done, take);
+        if (offset + take == slot->count) {
+          slot->used = false;
+        }
+        this->playTs += take;
+        done += take;
+        real += take;
+        continue;
+      }
+
+      Slot* next = earliestAfter(this->playTs);
+      if (next == nullptr) {
+        // Ran dry: conceal the rest and wait for the target delay again
+        this->counters.underruns++;
+        this->playing = false;
+        conceal(out + done, count - done);
+        break;
+      }
+      size_t gap = next->timestamp - this->playTs;
+      gap = gap < count - done ? gap : count - done;
+      conceal(out + done, gap);
+      this->playTs += gap;
+      done += gap;
+    }
+    return real;
+  }
+
+  RTSP_BackchannelStats stats() const {
+    RTSP_BackchannelStats result = this->counters;
+    uint32_t jitter = this->jitterQ4 >> 4;
+    result.jitterMs = static_cast<uint16_t>(jitter * 1000 / this->clockRate);
+    result.delayMs = this->playing ? static_cast<uint16_t>(bufferedSamples() * 1000 / this->clockRate) : 0;
+    result.targetMs = static_cast<uint16_t>(targetSamples() * 1000 / this->clockRate);
+    return result;
+  }
+
+private:
+  struct Slot {
+    bool used;
+    uint32_t timestamp;
+    uint16_t count;
+    int16_t samples[MaxSamples];
+  };
+
+  static constexpr size_t kConcealSamples = MaxSamples < 80 ? MaxSamples : 80;  // 10 ms at 8 kHz
+
+  // Enough to ride out three times the jitter plus one packet, within the limits
+  uint32_t targetSamples() const {
+    uint32_t target = 3 * (this->jitterQ4 >> 4) + this->packetSamples;
+    target = target > this->minDelay ? target : this->minDelay;
+    return target < this->maxDelay ? target : this->maxDelay;
+  }
+
+  // Audio stored from the playout point to the end of the newest packet
+  uint32_t bufferedSamples() const {
+    int32_t newest = 0;
+    for (size_t i = 0; i < Slots; i++) {
+      const Slot& slot = this->slots[i];
+      if (slot.used) {
+        int32_t end = static_cast<int32_t>(slot.timestamp + slot.count - this->playTs);
+        newest = end > newest ? end : newest;
+      }
+    }
+    return static_cast<uint32_t>(newest);
+  }
+
+  bool startPlayout() {
+    Slot* first = oldest();
+    if (first == nullptr) {
+      return false;
+    }
+    uint32_t previous = this->playTs;
+    this->playTs = first->timestamp;
+    if (bufferedSamples() < targetSamples()) {
+      this->playTs = previous;
+      return false;
+    }
+    this->playing = true;
+    return true;
+  }
+
+  // The slot holding the sample at ts; drops slots playout has passed
+  Slot* slotAt(uint32_t ts) {
+    for (size_t i = 0; i < Slots; i++) {
+      Slot& slot = this->slots[i];
+      if (!slot.used) {
+        continue;
+      }
+      int32_t offset = static_cast<int32_t>(ts - slot.timestamp);
+      if (offset >= static_cast<int32_t>(slot.count)) {
+        slot.used = false;
+      } else if (offset >= 0) {
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+  // The used slot that starts first
+  Slot* oldest() {
+    Slot* best = nullptr;
+    for (size_t i = 0; i < Slots; i++) {
+      Slot& slot = this->slots[i];
+      if (slot.used && (best == nullptr || static_cast<int32_t>(slot.timestamp - best->timestamp) < 0)) {
+        best = &slot;
+      }
+    }
+    return best;
+  }
+
+  // The used slot that starts first after ts
+  Slot* earliestAfter(uint32_t ts) {
+    Slot* best = nullptr;
+    int32_t bestDistance = 0;
+    for (size_t i = 0; i < Slots; i++) {
+      Slot& slot = this->slots[i];
+      int32_t distance = static_cast<int32_t>(slot.timestamp - ts);
+      if (slot.used && distance > 0 && (best == nullptr || distance < bestDistance)) {
+        best = &slot;
+        bestDistance = distance;
+      }
+    }
+    return best;
+  }
+
+  // Keeps the tail of what was played for concealment
+  void remember(const int16_t* samples, size_t count) {
+    if (count >= kConcealSamples) {
+      memcpy(this->concealBuf, samples + count - kConcealSamples, sizeof(this->concealBuf));
+      this->concealLen = kConcealSamples;
+    } else {
+      size_t keep = this->concealLen + count > kConcealSamples ? kConcealSamples - count : this->concealLen;
+      memmove(this->concealBuf, this->concealBuf + this->concealLen - keep, keep * sizeof(int16_t));
+      memcpy(this->concealBuf + keep, samples, count * sizeof(int16_t));
+      this->concealLen = keep + count;
+    }
+    this->concealPos = 0;
+    this->concealGain = 32767;
+  }
+
+  // Repeats the last audio played, halving the gain each time round
+  void conceal(int16_t* out, size_t count) {
+    this->counters.concealed += count;
+    for (size_t i = 0; i < count; i++) {
+      if (this->concealLen == 0 || this->concealGain == 0) {
+        out[i] = 0;
+        continue;
+      }
+      out[i] = static_cast<int16_t>((static_cast<int32_t>(this->concealBuf[this->concealPos]) * this->concealGain) >> 15);
+      if (++this->concealPos == this->concealLen) {
+        this->concealPos = 0;
+        this->concealGain >>= 1;
+      }
+    }
+  }
+
+  Slot slots[Slots];
+  uint32_t clockRate;
+  uint32_t minDelay;  // Samples
+  uint32_t maxDelay;
+  bool playing;
+  bool started;
+  uint32_t playTs;  // RTP timestamp of the next sample played
+  uint16_t highestSeq;
+  uint32_t lastTransit;
+  uint32_t jitterQ4;
+  uint32_t packetSamples;  // Length of the last packet
+  int16_t concealBuf[kConcealSamples];
+  size_t concealLen;
+  size_t concealPos;
+  int32_t concealGain;
+  RTSP_BackchannelStats counters = {};
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief The one clock every track is stamped from.
+ *
+ * Media time is the 64-bit monotonic microsecond count since boot, the
+ * clock esp_timer_get_time() reads and camera frames are stamped with.
+ * Each track maps it to its own RTP clock, so the timestamps of all tracks
+ * describe the same instants and a client can line them up.
+ */
+namespace RTSPMediaClock {
+// Microseconds of media time in units of an RTP clock, wrapping like RTP timestamps
+inline uint32_t toRtp(int64_t us, uint32_t rate) {
+  uint64_t t = us > 0 ? static_cast<uint64_t>(us) : 0;
+  return static_cast<uint32_t>((t / 1000000) * rate + (t % 1000000) * rate / 1000000);
+}
+}  // namespace RTSPMediaClock
+
+/**
+ * @brief Keeps an audio track's sample-counted RTP clock on the media clock.
+ *
+ * Audio timestamps advance by the samples sent, so they run on the audio
+ * codec's crystal while video follows the system clock, and the two drift
+ * apart by tens of ppm. Each block's capture time tells where the track
+ * should be; the difference is low-pass filtered to ride out capture
+ * jitter and paid back one sample per packet at most, so timestamps stay
+ * monotonic and the audio never audibly stretches. A larger gap, such as
+ * blocks dropped on overrun, is stepped over at once.
+ */
+class RTSPAudioClockSync {
+public:
+  RTSPAudioClockSync() : errorQ8(0), locked(false) {}
+
+  void reset() {
+    this->errorQ8 = 0;
+    this->locked = false;
+  }
+
+  // error is the media clock's RTP time of the next sample minus the track's; returns a step to apply now
+  int32_t observe(int32_t error, uint32_t rate) {
+    int32_t stepLimit = static_cast<int32_t>(rate * kStepMs / 1000);
+    if (!this->locked || error > stepLimit || error < -stepLimit) {
+      this->locked = true;
+      this->errorQ8 = 0;
+      return error;
+    }
+    this->errorQ8 += (error * 256 - this->errorQ8) / (1 << kFilterShift);
+    return 0;
+  }
+
+  // Samples to add to the timestamp before the next packet: -1, 0 or 1
+  int32_t correction() {
+    if (this->errorQ8 >= 256) {
+      this->errorQ8 -= 256;
+      return 1;
+    }
+    if (this->errorQ8 <= -256) {
+      this->errorQ8 += 256;
+      return -1;
+    }
+    return 0;
+  }
+
+private:
+  static constexpr uint32_t kStepMs = 40;    // Errors beyond this are stepped rather than slewed
+  static constexpr int kFilterShift = 5;     // Averages the error over about 32 blocks
+
+  int32_t errorQ8;  // Filtered error in samples, less the corrections already made
+  bool locked;
+};
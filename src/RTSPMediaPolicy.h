@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+// Audio codecs a policy can send, one bit per RTSPServerBase::AudioCodec
+namespace RTSPAudioCodecs {
+static constexpr uint8_t kL16 = 1 << 0;
+static constexpr uint8_t kPcmu = 1 << 1;
+static constexpr uint8_t kPcma = 1 << 2;
+static constexpr uint8_t kDvi4 = 1 << 3;
+static constexpr uint8_t kOpus = 1 << 4;
+static constexpr uint8_t kAll = kL16 | kPcmu | kPcma | kDvi4 | kOpus;
+}  // namespace RTSPAudioCodecs
+
+/**
+ * @brief Compile-time selection of the media tracks and transports a server
+ * is built with.
+ *
+ * The send path of RTSPServerCore is specialized on these flags, so a track or
+ * transport that is switched off costs neither flash nor a per-packet branch.
+ * Interleaved TCP covers RTSP-over-HTTP media as well; HttpTunnel only
+ * controls whether the GET/POST tunnel handshake is accepted. AudioCodecs is
+ * a mask of RTSPAudioCodecs; a codec outside it is never instantiated.
+ */
+template <bool Video, bool Audio, bool Subtitles, bool Udp, bool Multicast, bool Tcp, bool HttpTunnel,
+          uint8_t AudioCodecs = RTSPAudioCodecs::kAll>
+struct RTSPMediaPolicy {
+  static constexpr bool video = Video;
+  static constexpr bool audio = Audio;
+  static constexpr bool subtitles = Subtitles;
+  static constexpr bool udp = Udp;
+  static constexpr bool multicast = Multicast;
+  static constexpr bool tcp = Tcp || HttpTunnel;
+  static constexpr bool httpTunnel = HttpTunnel;
+  static constexpr uint8_t audioCodecs = Audio ? AudioCodecs : 0;
+};
+
+/**
+ * @brief Runtime copy of a policy, used by the control plane for cold checks
+ * such as rejecting a transport the build does not carry.
+ */
+struct RTSPMediaCaps {
+  bool video;
+  bool audio;
+  bool subtitles;
+  bool udp;
+  bool multicast;
+  bool tcp;
+  bool httpTunnel;
+  uint8_t audioCodecs;
+};
+
+// Default policy, trimmed with RTSP_DISABLE_* defines in RTSPConfig.h
+#ifdef RTSP_DISABLE_VIDEO
+  #define RTSP_POLICY_VIDEO false
+#else
+  #define RTSP_POLICY_VIDEO true
+#endif
+#ifdef RTSP_DISABLE_AUDIO
+  #define RTSP_POLICY_AUDIO false
+#else
+  #define RTSP_POLICY_AUDIO true
+#endif
+#ifdef RTSP_DISABLE_SUBTITLES
+  #define RTSP_POLICY_SUBTITLES false
+#else
+  #define RTSP_POLICY_SUBTITLES true
+#endif
+#ifdef RTSP_DISABLE_UDP
+  #define RTSP_POLICY_UDP false
+#else
+  #define RTSP_POLICY_UDP true
+#endif
+#ifdef RTSP_DISABLE_MULTICAST
+  #define RTSP_POLICY_MULTICAST false
+#else
+  #define RTSP_POLICY_MULTICAST true
+#endif
+#ifdef RTSP_DISABLE_TCP
+  #define RTSP_POLICY_TCP false
+#else
+  #define RTSP_POLICY_TCP true
+#endif
+#ifdef RTSP_DISABLE_HTTP_TUNNEL
+  #define RTSP_POLICY_HTTP_TUNNEL false
+#else
+  #define RTSP_POLICY_HTTP_TUNNEL true
+#endif
+
+#ifdef RTSP_DISABLE_L16
+  #define RTSP_POLICY_L16 0
+#else
+  #define RTSP_POLICY_L16 RTSPAudioCodecs::kL16
+#endif
+#ifdef RTSP_DISABLE_PCMU
+  #define RTSP_POLICY_PCMU 0
+#else
+  #define RTSP_POLICY_PCMU RTSPAudioCodecs::kPcmu
+#endif
+#ifdef RTSP_DISABLE_PCMA
+  #define RTSP_POLICY_PCMA 0
+#else
+  #define RTSP_POLICY_PCMA RTSPAudioCodecs::kPcma
+#endif
+#ifdef RTSP_DISABLE_DVI4
+  #define RTSP_POLICY_DVI4 0
+#else
+  #define RTSP_POLICY_DVI4 RTSPAudioCodecs::kDvi4
+#endif
+#ifdef RTSP_DISABLE_OPUS
+  #define RTSP_POLICY_OPUS 0
+#else
+  #define RTSP_POLICY_OPUS RTSPAudioCodecs::kOpus
+#endif
+
+typedef RTSPMediaPolicy<RTSP_POLICY_VIDEO, RTSP_POLICY_AUDIO, RTSP_POLICY_SUBTITLES,
+                        RTSP_POLICY_UDP, RTSP_POLICY_MULTICAST, RTSP_POLICY_TCP,
+                        RTSP_POLICY_HTTP_TUNNEL,
+                        RTSP_POLICY_L16 | RTSP_POLICY_PCMU | RTSP_POLICY_PCMA | RTSP_POLICY_DVI4 | RTSP_POLICY_OPUS> RTSPDefaultPolicy;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "RTSPAudioFramer.h"
+#include "RTSPFrameCache.h"
+#include "RTSPMediaClock.h"
+#include "RTSPRequestParser.h"
+#include "RTSPResampler.h"
+
+/**
+ * @brief One stream path served by the server: the tracks described and set
+ * up under it, its cached DESCRIBE reply and the state of its video feed.
+ *
+ * Mount 0 is the stream init() sets up and answers every path no other
+ * mount claims, so single-stream clients keep working with any URL.
+ * Further mounts are video substreams with their own track, RTP clock and
+ * frame cache, fed through sendRTSPFrame() with their mount index, or
+ * audio variants: the main stream's video and subtitles with an audio
+ * track of their own, resampled from what sendRTSPAudio() is given.
+ */
+struct RTSP_Mount {
+  const char* path;     // "/sub"; nullptr for mount 0
+  uint16_t videoPort;   // Server port of a substream's video track
+  uint8_t trackMask;    // Bit per track in this mount's SDP
+  int8_t videoTrack;    // Index into the server's tracks, -1 without video
+  RTSPFrameCache<3> frames;  // Last frame sent, replayed to sessions that start playing
+  RTSP_CachedFrame* volatile pendingFrame;  // Frame handed to the video task with RTSP_VIDEO_NONBLOCK
+  const RTSP_PayloadInfo* audioFormat;  // Codec of an audio variant, nullptr for other mounts
+  uint32_t audioRate;   // Sample rate of an audio variant
+  uint16_t audioPort;   // Server port of an audio variant's track
+  int8_t audioTrack;    // The variant's own audio track, -1 for other mounts
+  bool audioTalkspurt;  // The variant's next audio packet starts a talkspurt
+  RTSPResampler resampler;       // sampleRate to audioRate, run by the audio sending task
+  RTSPAudioFramer audioFramer;   // Cuts the variant's audio into audioPtime packets
+  RTSPAudioClockSync audioClock; // Holds the variant's timestamps to the media clock
+  char describeCache[RTSP_SDP_CACHE_SIZE];  // DESCRIBE reply after the Date line
+  uint16_t describeCacheLen;
+  uint32_t describeCacheIp;  // Local IP the cache was built for
+  bool describeCacheDirty;   // Set when the tracks or ports change
+
+  RTSP_Mount()
+    : path(nullptr),
+      videoPort(0),
+      trackMask(0),
+      videoTrack(-1),
+      pendingFrame(nullptr),
+      audioFormat(nullptr),
+      audioRate(0),
+      audioPort(0),
+      audioTrack(-1),
+      audioTalkspurt(true),
+      describeCacheLen(0),
+      describeCacheIp(0),
+      describeCacheDirty(true) {}
+};
+
+namespace RTSPMountPath {
+// Path of an rtsp:// URL ("/sub/video"); a URL without a scheme is taken as a path
+inline RTSP_StringView ofUrl(const RTSP_StringView& url) {
+  const char* scheme = url.find("://");
+  if (scheme == nullptr) {
+    return url;
+  }
+  const char* end = url.data + url.len;
+  const char* p = scheme + 3;
+  while (p < end && *p != '/') {
+    p++;
+  }
+  return RTSP_StringView{p, static_cast<size_t>(end - p)};
+}
+
+// True when path is mountPath itself or something below it
+inline bool matches(const RTSP_StringView& path, const char* mountPath) {
+  if (!path.startsWith(mountPath)) {
+    return false;
+  }
+  size_t n = strlen(mountPath);
+  return path.len == n || path.data[n] == '/' || path.data[n] == '?';
+}
+}  // namespace RTSPMountPath
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Opus is sent when an Opus library is installed, e.g. arduino-libopus or
+// the esp-libopus component; without one AUDIO_OPUS fails at init().
+#if defined(__has_include)
+  #if __has_include(<opus.h>)
+    #include <opus.h>
+    #define RTSP_OPUS_AVAILABLE
+  #elif __has_include(<opus/opus.h>)
+    #include <opus/opus.h>
+    #define RTSP_OPUS_AVAILABLE
+  #endif
+#endif
+
+/**
+ * @brief Mono Opus speech encoder of one audio track.
+ *
+ * The encoder state is allocated the first time the track is configured
+ * and initialised in place after that, so a server that is restarted does
+ * not allocate again. It is freed with release().
+ */
+class RTSPOpusEncoder {
+public:
+  RTSPOpusEncoder() : state(nullptr), ready(false) {}
+
+  // Sets up the encoder for rate; false without an Opus library, on an unsupported rate or out of memory
+  bool configure(uint32_t rate, uint32_t bitrate, uint8_t complexity) {
+    this->ready = false;
+#ifdef RTSP_OPUS_AVAILABLE
+    if (this->state == nullptr) {
+      this->state = malloc(opus_encoder_get_size(1));
+      if (this->state == nullptr) {
+        return false;
+      }
+    }
+    OpusEncoder* encoder = static_cast<OpusEncoder*>(this->state);
+    if (opus_encoder_init(encoder, static_cast<opus_int32>(rate), 1, OPUS_APPLICATION_VOIP) != OPUS_OK) {
+      return false;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(static_cast<opus_int32>(bitrate)));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+    opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    this->ready = true;
+#endif
+    return this->ready;
+  }
+
+  // Encodes one frame of 2.5 to 60 ms; returns the packet length, 0 on failure
+  size_t encode(const int16_t* samples, size_t count, uint8_t* out, size_t maxBytes) {
+#ifdef RTSP_OPUS_AVAILABLE
+    if (this->ready) {
+      opus_int32 len = opus_encode(static_cast<OpusEncoder*>(this->state), samples, static_cast<int>(count), out, static_cast<opus_int32>(maxBytes));
+      return len > 0 ? static_cast<size_t>(len) : 0;
+    }
+#endif
+    return 0;
+  }
+
+  void release() {
+    free(this->state);
+    this->state = nullptr;
+    this->ready = false;
+  }
+
+private:
+  void* state;  // OpusEncoder
+  bool ready;
+};
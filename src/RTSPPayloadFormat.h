@@ -0,0 +1,455 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "RTSPAdpcm.h"
+#include "RTSPByteSwap.h"
+#include "RTSPG711.h"
+#include "RTSPMediaClock.h"
+#include "RTSPOpus.h"
+
+#ifndef RTSP_MAX_TRACKS
+  #define RTSP_MAX_TRACKS 4 // max media tracks over all mounts, at most 8
+#endif
+
+struct RTSP_Track;
+
+typedef size_t (*RTSP_DescribeFn)(char* out, size_t maxLen, const RTSP_Track& track);
+
+/**
+ * @brief Control-plane view of a payload format, used to build the SDP.
+ */
+struct RTSP_PayloadInfo {
+  const char* media;         // SDP media type: video, audio or text
+  uint8_t payloadType;
+  uint32_t clockRate;        // 0 when the track supplies it, e.g. L16 at the sample rate
+  size_t maxPayload;
+  RTSP_DescribeFn describe;  // rtpmap/fmtp lines for the track
+};
+
+struct RTSP_StreamState {
+  uint16_t sequenceNumber;
+  uint32_t timestamp;
+  uint32_t ssrc;
+};
+
+/**
+ * @brief A media track registered at init(): one payload format plus the
+ * sockets, ports and RTP state it is sent with.
+ */
+struct RTSP_Track {
+  const RTSP_PayloadInfo* format;
+  const char* control;    // a=control name, matched against the SETUP URL
+  const char* direction;  // Optional a= direction attribute, or nullptr
+  uint32_t clockRate;
+  uint8_t ticksPerSample;  // RTP clock ticks per PCM sample: 48 kHz Opus over the sample rate, otherwise 1
+  uint8_t ptime;          // Milliseconds of audio per packet, 0 when packets follow the sketch's blocks
+  bool comfortNoise;      // Silences are sent as RFC 3389 comfort noise, a second payload type
+  uint16_t serverPort;
+  int unicastSocket;
+  int multicastSocket;
+  RTSP_StreamState stream;
+#ifndef RTSP_DISABLE_DVI4
+  RTSPImaAdpcm::State adpcm;  // DVI4 encoder state carried from block to block
+#endif
+#ifndef RTSP_DISABLE_OPUS
+  RTSPOpusEncoder opus;  // Opus encoder state carried from frame to frame
+#endif
+};
+
+namespace RTSPPacket {
+// Packet layout: 4 byte interleaved prefix (only sent on TCP), RTP header, payload
+static constexpr size_t kInterleavedHeaderSize = 4;
+static constexpr size_t kRtpHeaderSize = 12;
+static constexpr size_t kPayloadOffset = kInterleavedHeaderSize + kRtpHeaderSize;
+
+inline void writeHeader(uint8_t* packet, const RTSP_Track& track, uint8_t payloadType, bool marker, size_t payloadLen) {
+  size_t rtpPacketSize = kRtpHeaderSize + payloadLen;
+  const RTSP_StreamState& stream = track.stream;
+
+  // If TCP, we need these first 4 bytes
+  packet[0] = '$'; // Magic number
+  packet[1] = 0; // Channel number for RTP, set per TCP receiver
+  packet[2] = (rtpPacketSize >> 8) & 0xFF; // Packet length high byte
+  packet[3] = rtpPacketSize & 0xFF; // Packet length low byte
+
+  // RTP header
+  packet[4] = 0x80; // Version: 2, Padding: 0, Extension: 0, CSRC Count: 0
+  packet[5] = payloadType | (marker ? 0x80 : 0x00);
+  packet[6] = (stream.sequenceNumber >> 8) & 0xFF;
+  packet[7] = stream.sequenceNumber & 0xFF;
+  packet[8] = (stream.timestamp >> 24) & 0xFF;
+  packet[9] = (stream.timestamp >> 16) & 0xFF;
+  packet[10] = (stream.timestamp >> 8) & 0xFF;
+  packet[11] = stream.timestamp & 0xFF;
+  packet[12] = (stream.ssrc >> 24) & 0xFF;
+  packet[13] = (stream.ssrc >> 16) & 0xFF;
+  packet[14] = (stream.ssrc >> 8) & 0xFF;
+  packet[15] = stream.ssrc & 0xFF;
+}
+}  // namespace RTSPPacket
+
+namespace RTSPAudioSdp {
+// Comfort noise has a static payload type at 8 kHz only; other rates map a dynamic one
+inline uint8_t comfortNoisePayloadType(const RTSP_Track& track) {
+  return track.clockRate == 8000 ? 13 : 100;
+}
+
+// rtpmap lines of a mono audio track, plus its ptime when packets have a fixed length
+inline size_t describe(char* out, size_t maxLen, const RTSP_Track& track, uint8_t payloadType, const char* name) {
+  int len = snprintf(out, maxLen, "a=rtpmap:%u %s/%lu/1\r\n", payloadType, name, (unsigned long)track.clockRate);
+  if (len > 0 && track.comfortNoise && static_cast<size_t>(len) < maxLen) {
+    int cnLen = snprintf(out + len, maxLen - len, "a=rtpmap:%u CN/%lu\r\n", comfortNoisePayloadType(track), (unsigned long)track.clockRate);
+    len = cnLen > 0 ? len + cnLen : len;
+  }
+  if (len > 0 && track.ptime != 0 && static_cast<size_t>(len) < maxLen) {
+    int ptimeLen = snprintf(out + len, maxLen - len, "a=ptime:%u\r\n", track.ptime);
+    len = ptimeLen > 0 ? len + ptimeLen : len;
+  }
+  return len > 0 ? static_cast<size_t>(len) : 0;
+}
+}  // namespace RTSPAudioSdp
+
+/*
+ * Payload formats. Each one provides:
+ *   Input               what the sketch hands over for one send
+ *   payloadType, clockRate, headerSize, maxPayload
+ *   info                RTSP_PayloadInfo for the SDP
+ *   packetize()         fills packet[] one RTP packet at a time and calls
+ *                       emit(packetSize) after each, advancing track.stream
+ * Audio formats a backchannel can receive also provide
+ *   depacketizedSamples(), depacketize()   received payload back to PCM
+ * packetize() is a template so the fan-out loop passed as emit is inlined.
+ */
+
+// RFC 2435 JPEG
+struct RTSPJpegFormat {
+  struct Input {
+    const uint8_t* data;
+    size_t len;
+    uint8_t quality;
+    uint16_t width;
+    uint16_t height;
+  };
+
+  static constexpr uint8_t payloadType = 26;
+  static constexpr uint32_t clockRate = 90000;
+  static constexpr size_t headerSize = 8;
+  static constexpr size_t maxPayload = 1438;
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    return 0; // Static payload type, no rtpmap needed
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"video", payloadType, clockRate, maxPayload, describe};
+
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t fragmentOffset = 0;
+    while (fragmentOffset < in.len) {
+      size_t fragmentLen = maxPayload;
+      if (fragmentLen + fragmentOffset > in.len) {
+        fragmentLen = in.len - fragmentOffset;
+      }
+
+      bool isLastFragment = (fragmentOffset + fragmentLen) == in.len;
+      RTSPPacket::writeHeader(packet, track, payloadType, isLastFragment, headerSize + fragmentLen);
+
+      // JPEG RTP header
+      uint8_t* jpegHeader = packet + RTSPPacket::kPayloadOffset;
+      jpegHeader[0] = 0x00;
+      jpegHeader[1] = (fragmentOffset >> 16) & 0xFF;
+      jpegHeader[2] = (fragmentOffset >> 8) & 0xFF;
+      jpegHeader[3] = fragmentOffset & 0xFF;
+      jpegHeader[4] = 0x00;
+      jpegHeader[5] = in.quality;
+      jpegHeader[6] = in.width / 8;
+      jpegHeader[7] = in.height / 8;
+
+      // Copy JPEG data to the packet
+      memcpy(jpegHeader + headerSize, in.data + fragmentOffset, fragmentLen);
+
+      emit(RTSPPacket::kPayloadOffset + headerSize + fragmentLen);
+      fragmentOffset += fragmentLen;
+      track.stream.sequenceNumber++;
+    }
+  }
+};
+
+// RFC 3551 L16, mono, at the configured sample rate
+struct RTSPL16Format {
+  struct Input {
+    const int16_t* samples;
+    size_t len;  // Bytes
+    bool talkspurt;  // First packet after silence, sent with the marker bit
+  };
+
+  static constexpr uint8_t payloadType = 97;
+  static constexpr uint32_t clockRate = 0;
+  static constexpr size_t headerSize = 0;
+  static constexpr size_t maxPayload = 1444;  // A whole number of words, so every fragment stays word-aligned
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    return RTSPAudioSdp::describe(out, maxLen, track, payloadType, "L16");
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"audio", payloadType, clockRate, maxPayload, describe};
+
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t fragmentOffset = 0;
+    while (fragmentOffset < in.len) {
+      size_t fragmentLen = maxPayload;
+      if (fragmentLen + fragmentOffset > in.len) {
+        fragmentLen = in.len - fragmentOffset;
+      }
+
+      // Marker bit on the first packet of a talkspurt
+      RTSPPacket::writeHeader(packet, track, payloadType, in.talkspurt && fragmentOffset == 0, fragmentLen);
+
+      // Convert audio data from little-endian to big-endian while copying it to the packet
+      RTSPByteSwap::toNetwork16(packet + RTSPPacket::kPayloadOffset, in.samples + fragmentOffset / 2, fragmentLen / 2);
+
+      emit(RTSPPacket::kPayloadOffset + fragmentLen);
+      fragmentOffset += fragmentLen;
+      track.stream.sequenceNumber++;
+      track.stream.timestamp += fragmentLen / 2; // Convert fragment length to number of samples
+    }
+  }
+
+  static size_t depacketizedSamples(size_t payloadLen) {
+    return payloadLen / 2;
+  }
+
+  static void depacketize(const uint8_t* payload, size_t count, int16_t* out) {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = static_cast<int16_t>((payload[2 * i] << 8) | payload[2 * i + 1]);
+    }
+  }
+};
+
+// G.711 companding laws for RTSPG711Format
+struct RTSPUlaw {
+  static constexpr uint8_t payloadType = 0;
+  static constexpr const char* name = "PCMU";
+  static uint8_t encode(int16_t sample) { return RTSPG711::encodeUlaw(sample); }
+  static int16_t decode(uint8_t code) { return RTSPG711::decodeUlaw(code); }
+};
+
+struct RTSPAlaw {
+  static constexpr uint8_t payloadType = 8;
+  static constexpr const char* name = "PCMA";
+  static uint8_t encode(int16_t sample) { return RTSPG711::encodeAlaw(sample); }
+  static int16_t decode(uint8_t code) { return RTSPG711::decodeAlaw(code); }
+};
+
+// RFC 3551 PCMU/PCMA, mono, 8 kHz. Takes the same PCM blocks as L16 and
+// encodes straight into the packet that every receiver gets, so a block
+// is encoded once however many sessions play it.
+template <class Law>
+struct RTSPG711Format {
+  struct Input {
+    const int16_t* samples;
+    size_t len;  // Bytes of PCM
+    bool talkspurt;  // First packet after silence, sent with the marker bit
+  };
+
+  static constexpr uint8_t payloadType = Law::payloadType;
+  static constexpr uint32_t clockRate = 8000;
+  static constexpr size_t headerSize = 0;
+  static constexpr size_t maxPayload = 1446;
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    return RTSPAudioSdp::describe(out, maxLen, track, payloadType, Law::name);
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"audio", payloadType, clockRate, maxPayload, describe};
+
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t count = in.len / 2;
+    size_t offset = 0;
+    while (offset < count) {
+      size_t fragmentLen = count - offset < maxPayload ? count - offset : maxPayload;
+      RTSPPacket::writeHeader(packet, track, payloadType, in.talkspurt && offset == 0, fragmentLen);
+
+      // One byte per sample
+      uint8_t* payload = packet + RTSPPacket::kPayloadOffset;
+      const int16_t* samples = in.samples + offset;
+      for (size_t i = 0; i < fragmentLen; i++) {
+        payload[i] = Law::encode(samples[i]);
+      }
+
+      emit(RTSPPacket::kPayloadOffset + fragmentLen);
+      offset += fragmentLen;
+      track.stream.sequenceNumber++;
+      track.stream.timestamp += fragmentLen;
+    }
+  }
+
+  static size_t depacketizedSamples(size_t payloadLen) {
+    return payloadLen;
+  }
+
+  static void depacketize(const uint8_t* payload, size_t count, int16_t* out) {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = Law::decode(payload[i]);
+    }
+  }
+};
+
+template <class Law>
+constexpr RTSP_PayloadInfo RTSPG711Format<Law>::info;
+
+typedef RTSPG711Format<RTSPUlaw> RTSPPcmuFormat;
+typedef RTSPG711Format<RTSPAlaw> RTSPPcmaFormat;
+
+// RFC 3551 DVI4 (IMA ADPCM), mono, at the configured sample rate. Each packet
+// starts with the encoder state it was encoded from, so a receiver can pick up
+// the stream at any packet; the state itself lives in the track and runs on
+// across blocks. Like G.711, a block is encoded once for every session.
+// RTSP_DISABLE_DVI4 leaves only the descriptor, and the track no state.
+struct RTSPDvi4Format {
+  struct Input {
+    const int16_t* samples;
+    size_t len;  // Bytes of PCM
+    bool talkspurt;  // First packet after silence, sent with the marker bit
+  };
+
+  static constexpr uint8_t payloadType = 99;
+  static constexpr uint32_t clockRate = 0;
+  static constexpr size_t headerSize = 4;
+  static constexpr size_t maxPayload = 1442;
+  static constexpr size_t maxSamples = maxPayload * 2;
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    return RTSPAudioSdp::describe(out, maxLen, track, payloadType, "DVI4");
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"audio", payloadType, clockRate, maxPayload, describe};
+
+#ifndef RTSP_DISABLE_DVI4
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t count = in.len / 2;
+    size_t offset = 0;
+    while (offset < count) {
+      size_t fragmentLen = count - offset < maxSamples ? count - offset : maxSamples;
+      size_t payloadLen = headerSize + (fragmentLen + 1) / 2;
+      RTSPPacket::writeHeader(packet, track, payloadType, in.talkspurt && offset == 0, payloadLen);
+
+      // DVI4 header: predicted value, step index, reserved
+      uint8_t* dviHeader = packet + RTSPPacket::kPayloadOffset;
+      dviHeader[0] = (track.adpcm.predictor >> 8) & 0xFF;
+      dviHeader[1] = track.adpcm.predictor & 0xFF;
+      dviHeader[2] = track.adpcm.stepIndex;
+      dviHeader[3] = 0;
+
+      RTSPImaAdpcm::encode(track.adpcm, in.samples + offset, fragmentLen, dviHeader + headerSize);
+
+      emit(RTSPPacket::kPayloadOffset + payloadLen);
+      offset += fragmentLen;
+      track.stream.sequenceNumber++;
+      track.stream.timestamp += fragmentLen;
+    }
+  }
+#endif
+};
+
+// RFC 7587 Opus, mono speech at the configured sample rate. The RTP clock
+// is always 48 kHz and the SDP always says two channels, as the RFC has it;
+// the capture rate and mono are fmtp parameters. Each packet is one frame,
+// so the track always has a ptime, and every frame is encoded once for all
+// sessions. A frame the encoder fails on is skipped on the RTP clock.
+// RTSP_DISABLE_OPUS leaves only the descriptor, and the track no encoder.
+struct RTSPOpusFormat {
+  struct Input {
+    const int16_t* samples;
+    size_t len;  // Bytes of PCM, one frame
+    bool talkspurt;  // First packet after silence, sent with the marker bit
+  };
+
+  static constexpr uint8_t payloadType = 101;
+  static constexpr uint32_t clockRate = 48000;
+  static constexpr size_t headerSize = 0;
+  static constexpr size_t maxPayload = 1275;  // Longest Opus frame
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    int len = snprintf(out, maxLen, "a=rtpmap:%u opus/48000/2\r\na=fmtp:%u sprop-maxcapturerate=%lu;sprop-stereo=0;stereo=0\r\na=ptime:%u\r\n",
+                       payloadType, payloadType, (unsigned long)(track.clockRate / track.ticksPerSample), track.ptime);
+    return len > 0 ? static_cast<size_t>(len) : 0;
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"audio", payloadType, clockRate, maxPayload, describe};
+
+#ifndef RTSP_DISABLE_OPUS
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t count = in.len / 2;
+    size_t payloadLen = track.opus.encode(in.samples, count, packet + RTSPPacket::kPayloadOffset, maxPayload);
+    if (payloadLen > 0) {
+      RTSPPacket::writeHeader(packet, track, payloadType, in.talkspurt, payloadLen);
+      emit(RTSPPacket::kPayloadOffset + payloadLen);
+      track.stream.sequenceNumber++;
+    }
+    track.stream.timestamp += count * track.ticksPerSample;
+  }
+#endif
+};
+
+// RFC 3389 comfort noise, sent on an audio track in place of silent packets.
+// Only the noise level is carried; the track's timestamp is advanced by
+// the silence itself, not by this packet.
+struct RTSPComfortNoiseFormat {
+  struct Input {
+    uint8_t level;  // Noise level in -dBov
+  };
+
+  static constexpr size_t headerSize = 0;
+  static constexpr size_t maxPayload = 1;
+
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    RTSPPacket::writeHeader(packet, track, RTSPAudioSdp::comfortNoisePayloadType(track), false, 1);
+    packet[RTSPPacket::kPayloadOffset] = in.level & 0x7F;
+    emit(RTSPPacket::kPayloadOffset + 1);
+    track.stream.sequenceNumber++;
+  }
+};
+
+// RFC 4103 T.140 text, used for subtitles
+struct RTSPT140Format {
+  struct Input {
+    const char* text;
+    size_t len;
+  };
+
+  static constexpr uint8_t payloadType = 98;
+  static constexpr uint32_t clockRate = 1000;
+  static constexpr size_t headerSize = 0;
+  static constexpr size_t maxPayload = 496;
+
+  static size_t describe(char* out, size_t maxLen, const RTSP_Track& track) {
+    int len = snprintf(out, maxLen, "a=rtpmap:%u t140/%lu\r\n", payloadType, (unsigned long)clockRate);
+    return len > 0 ? static_cast<size_t>(len) : 0;
+  }
+
+  static constexpr RTSP_PayloadInfo info = {"text", payloadType, clockRate, maxPayload, describe};
+
+  template <class Emit>
+  static void packetize(const Input& in, RTSP_Track& track, uint8_t* packet, Emit&& emit) {
+    size_t len = in.len < maxPayload ? in.len : maxPayload;
+
+    // Marker bit set
+    RTSPPacket::writeHeader(packet, track, payloadType, true, len);
+
+    // Copy SRT data to the packet
+    memcpy(packet + RTSPPacket::kPayloadOffset, in.text, len);
+
+    emit(RTSPPacket::kPayloadOffset + len);
+    track.stream.sequenceNumber++;
+    // The timestamp is set from the media clock before each packet
+  }
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Non-owning view into a connection's input buffer.
+ */
+struct RTSP_StringView {
+  const char* data;
+  size_t len;
+
+  bool empty() const {
+    return this->len == 0;
+  }
+
+  bool equals(const char* s) const {
+    size_t n = strlen(s);
+    return this->len == n && memcmp(this->data, s, n) == 0;
+  }
+
+  bool startsWith(const char* s) const {
+    size_t n = strlen(s);
+    return this->len >= n && memcmp(this->data, s, n) == 0;
+  }
+
+  // Returns a pointer to the first occurrence of s, or nullptr
+  const char* find(const char* s) const {
+    size_t n = strlen(s);
+    if (n == 0 || n > this->len) {
+      return nullptr;
+    }
+    for (size_t i = 0; i + n <= this->len; i++) {
+      if (this->data[i] == s[0] && memcmp(this->data + i, s, n) == 0) {
+        return this->data + i;
+      }
+    }
+    return nullptr;
+  }
+
+  bool contains(const char* s) const {
+    return find(s) != nullptr;
+  }
+
+  // Leading decimal digits as an unsigned number, 0 if none
+  uint32_t toUInt() const {
+    uint32_t value = 0;
+    for (size_t i = 0; i < this->len && this->data[i] >= '0' && this->data[i] <= '9'; i++) {
+      value = value * 10 + (this->data[i] - '0');
+    }
+    return value;
+  }
+
+  // Copies into a null-terminated buffer, truncating to fit
+  size_t copyTo(char* out, size_t maxLen) const {
+    if (maxLen == 0) {
+      return 0;
+    }
+    size_t n = this->len < maxLen - 1 ? this->len : maxLen - 1;
+    memcpy(out, this->data, n);
+    out[n] = '\0';
+    return n;
+  }
+};
+
+/**
+ * @brief One parsed request. Every view points into the connection's input
+ * buffer and stays valid until that message is consumed.
+ */
+struct RTSP_Request {
+  RTSP_StringView method;
+  RTSP_StringView url;
+  RTSP_StringView version;  // RTSP/1.0, or HTTP/1.x for tunnel requests
+  int cseq;                 // -1 when the header is missing
+  uint32_t sessionID;       // 0 when the header is missing
+  RTSP_StringView transport;
+  RTSP_StringView authorization;
+  RTSP_StringView sessionCookie;
+  RTSP_StringView accept;
+  RTSP_StringView contentType;
+  RTSP_StringView userAgent;
+  size_t contentLength;
+  RTSP_StringView body;
+
+  bool isHttp() const {
+    return this->version.startsWith("HTTP/");
+  }
+};
+
+/**
+ * @brief Incremental, single-pass parser for the bytes buffered on one RTSP
+ * connection.
+ *
+ * The buffer may hold RTSP/HTTP text messages and `$`-framed interleaved
+ * packets back to back. parse() looks at the message at the start of the
+ * buffer only; the caller consumes it and calls again for the next one, so
+ * pipelined requests in a single read are all served.
+ */
+class RTSPRequestParser {
+public:
+  enum Status {
+    NeedMore,     // Message incomplete; read more and call again
+    Request,      // request filled in
+    Interleaved,  // `$` frame of consumed bytes, e.g. RTCP from the client
+    Skip,         // consumed bytes carry nothing, e.g. line breaks between messages
+    Invalid,      // Unparseable; drop the buffered input
+  };
+
+  /**
+   * @param scanned  Bytes of buf already known to hold no end of headers.
+   *                 Updated on NeedMore so the next call resumes there.
+   * @param consumed Set to the bytes to drop on Request/Interleaved/Skip.
+   */
+  static Status parse(const char* buf, size_t len, size_t& scanned, RTSP_Request& request, size_t& consumed) {
+    consumed = 0;
+
+    // Stray line breaks between messages are allowed
+    size_t start = 0;
+    while (start < len && (buf[start] == '\r' || buf[start] == '\n')) {
+      start++;
+    }
+    if (start == len) {
+      return NeedMore;
+    }
+    if (start > 0) {
+      consumed = start;
+      scanned = 0;
+      return Skip;
+    }
+
+    if (buf[0] == '$') {
+      if (len < 4) {
+        return NeedMore;
+      }
+      size_t frameLen = 4 + ((static_cast<uint8_t>(buf[2]) << 8) | static_cast<uint8_t>(buf[3]));
+      if (len < frameLen) {
+        return NeedMore;
+      }
+      consumed = frameLen;
+      return Interleaved;
+    }
+
+    // Methods are upper-case ASCII; anything else is binary noise
+    if (buf[0] < 'A' || buf[0] > 'Z') {
+      return Invalid;
+    }
+
+    // Find the blank line ending the headers, resuming where the last call stopped
+    size_t headerEnd = 0;
+    size_t i = scanned > 2 ? scanned - 2 : 0;
+    for (; i < len; i++) {
+      if (buf[i] != '\n') {
+        continue;
+      }
+      if (i + 1 < len && buf[i + 1] == '\n') {
+        headerEnd = i + 2;
+        break;
+      }
+      if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+        headerEnd = i + 3;
+        break;
+      }
+    }
+    if (headerEnd == 0) {
+      scanned = len;
+      return NeedMore;
+    }
+
+    request = RTSP_Request();
+    request.cseq = -1;
+    if (!parseHeaders(buf, headerEnd, request)) {
+      return Invalid;
+    }
+
+    // HTTP tunnel POSTs announce a huge Content-Length and then stream base64
+    // for the life of the connection, so only RTSP bodies are framed
+    size_t total = headerEnd;
+    if (!request.isHttp() && request.contentLength > 0) {
+      total += request.contentLength;
+      if (len < total) {
+        return NeedMore;
+      }
+      request.body = {buf + headerEnd, request.contentLength};
+    }
+
+    consumed = total;
+    scanned = 0;
+    return Request;
+  }
+
+private:
+  static bool nameIs(const char* name, size_t nameLen, const char* expected) {
+    size_t n = strlen(expected);
+    if (nameLen != n) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      char a = name[i];
+      char b = expected[i];
+      if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+      if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+      if (a != b) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool parseHeaders(const char* buf, size_t len, RTSP_Request& request) {
+    size_t pos = 0;
+    bool firstLine = true;
+    while (pos < len) {
+      size_t lineEnd = pos;
+      while (lineEnd < len && buf[lineEnd] != '\n') {
+        lineEnd++;
+      }
+      size_t end = lineEnd;
+      if (end > pos && buf[end - 1] == '\r') {
+        end--;
+      }
+      if (end == pos) {
+        break;  // Blank line
+      }
+
+      if (firstLine) {
+        // METHOD SP URL SP VERSION
+        const char* line = buf + pos;
+        size_t lineLen = end - pos;
+        const char* sp1 = static_cast<const char*>(memchr(line, ' ', lineLen));
+        if (!sp1) {
+          return false;
+        }
+        const char* urlStart = sp1 + 1;
+        const char* sp2 = static_cast<const char*>(memchr(urlStart, ' ', line + lineLen - urlStart));
+        request.method = {line, static_cast<size_t>(sp1 - line)};
+        if (sp2) {
+          request.url = {urlStart, static_cast<size_t>(sp2 - urlStart)};
+          request.version = {sp2 + 1, static_cast<size_t>(line + lineLen - sp2 - 1)};
+        } else {
+          request.url = {urlStart, static_cast<size_t>(line + lineLen - urlStart)};
+        }
+        firstLine = false;
+      } else {
+        const char* name = buf + pos;
+        const char* colon = static_cast<const char*>(memchr(name, ':', end - pos));
+        if (colon) {
+          size_t nameLen = colon - name;
+          const char* value = colon + 1;
+          const char* valueEnd = buf + end;
+          while (value < valueEnd && (*value == ' ' || *value == '\t')) value++;
+          while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) valueEnd--;
+          RTSP_StringView view = {value, static_cast<size_t>(valueEnd - value)};
+
+          if (nameIs(name, nameLen, "CSeq")) {
+            request.cseq = view.empty() ? -1 : static_cast<int>(view.toUInt());
+          } else if (nameIs(name, nameLen, "Session")) {
+            request.sessionID = view.toUInt();  // Stops at ;timeout=
+          } else if (nameIs(name, nameLen, "Transport")) {
+            request.transport = view;
+          } else if (nameIs(name, nameLen, "Authorization")) {
+            request.authorization = view;
+          } else if (nameIs(name, nameLen, "x-sessioncookie")) {
+            request.sessionCookie = view;
+          } else if (nameIs(name, nameLen, "Accept")) {
+            request.accept = view;
+          } else if (nameIs(name, nameLen, "Content-Type")) {
+            request.contentType = view;
+          } else if (nameIs(name, nameLen, "Content-Length")) {
+            request.contentLength = view.toUInt();
+          } else if (nameIs(name, nameLen, "User-Agent")) {
+            request.userAgent = view;
+          }
+        }
+      }
+      pos = lineEnd + 1;
+    }
+    return !request.method.empty();
+  }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+/**
+ * @brief Fixed-point polyphase resampler for mono 16-bit PCM.
+ *
+ * The rate ratio is reduced to up/down. A windowed-sinc low-pass, cut off
+ * below the lower of the two Nyquist rates, is split into one phase per
+ * output position between two input samples; each output sample is then
+ * a single dot product of one phase with the newest input samples, in Q14
+ * with a 32-bit accumulator. Input is taken in chunks behind the history
+ * the filter needs, so the inner loop always runs over contiguous memory.
+ * Equal rates pass the input through untouched.
+ */
+class RTSPResampler {
+public:
+  RTSPResampler() : coeffs(nullptr), work(nullptr), out(nullptr), up(0), down(1), taps(0), phase(0), pos(0) {}
+
+  ~RTSPResampler() {
+    release();
+  }
+
+  RTSPResampler(const RTSPResampler&) = delete;
+  RTSPResampler& operator=(const RTSPResampler&) = delete;
+
+  // Builds the filter for a rate pair; false if a rate is 0, the ratio is too fine or memory ran out
+  bool configure(uint32_t inRate, uint32_t outRate) {
+    release();
+    if (inRate == 0 || outRate == 0) {
+      return false;
+    }
+    uint32_t divisor = gcd(inRate, outRate);
+    this->up = outRate / divisor;
+    this->down = inRate / divisor;
+    if (this->up == this->down) {
+      return true;
+    }
+
+    // Enough taps per phase to reach kZeroCrossings zero crossings of the sinc either side,
+    // fewer for fine ratios such as 22050 to 16000 whose many phases would not fit the table
+    size_t perCrossing = 2 * ((this->down + this->up - 1) / this->up);
+    size_t crossings = kZeroCrossings;
+    while (crossings > kMinZeroCrossings && this->up * perCrossing * crossings > kMaxCoeffs) {
+      crossings /= 2;
+    }
+    this->taps = perCrossing * crossings;
+    if (this->up * this->taps > kMaxCoeffs) {
+      return false;
+    }
+    this->coeffs = new (std::nothrow) int16_t[this->up * this->taps];
+    this->work = new (std::nothrow) int16_t[this->taps - 1 + kChunk];
+    this->out = new (std::nothrow) int16_t[outputCapacity()];
+    if (this->coeffs == nullptr || this->work == nullptr || this->out == nullptr) {
+      release();
+      return false;
+    }
+
+    // Prototype low-pass at the interpolated rate, Blackman windowed, with a gain of up
+    // to make up for the zeros interpolation puts between input samples
+    size_t length = this->up * this->taps;
+    double cutoff = 0.5 / (this->up > this->down ? this->up : this->down) * 0.95;
+    double centre = (length - 1) / 2.0;
+    for (size_t i = 0; i < length; i++) {
+      double t = i - centre;
+      double sinc = t == 0 ? 1.0 : sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+      double window = 0.42 - 0.5 * cos(2 * M_PI * i / (length - 1)) + 0.08 * cos(4 * M_PI * i / (length - 1));
+      double h = this->up * 2 * cutoff * sinc * window;
+      // Phase p holds taps p, p + up, p + 2 up..., stored oldest sample first
+      size_t p = i % this->up;
+      size_t k = i / this->up;
+      this->coeffs[p * this->taps + (this->taps - 1 - k)] = static_cast<int16_t>(lround(h * (1 << kCoeffBits)));
+    }
+    memset(this->work, 0, (this->taps - 1) * sizeof(int16_t));
+    this->phase = 0;
+    this->pos = this->taps - 1;
+    return true;
+  }
+
+  bool passthrough() const {
+    return this->up == this->down;
+  }
+
+  // Calls emit(samples, count) with the resampled output, one or more times per block
+  template <class Emit>
+  void process(const int16_t* samples, size_t count, Emit&& emit) {
+    if (passthrough()) {
+      if (count > 0) {
+        emit(samples, count);
+      }
+      return;
+    }
+    if (this->coeffs == nullptr) {
+      return;
+    }
+
+    const size_t history = this->taps - 1;
+    while (count > 0) {
+      size_t n = count < kChunk ? count : kChunk;
+      memcpy(this->work + history, samples, n * sizeof(int16_t));
+      size_t end = history + n;
+
+      // pos is the newest input sample of the next output; the taps before it are in work too
+      size_t produced = 0;
+      while (this->pos < end) {
+        const int16_t* h = this->coeffs + this->phase * this->taps;
+        const int16_t* x = this->work + this->pos - history;
+        int32_t acc = 1 << (kCoeffBits - 1);
+        for (size_t k = 0; k < this->taps; k++) {
+          acc += static_cast<int32_t>(h[k]) * x[k];
+        }
+        acc >>= kCoeffBits;
+        this->out[produced++] = static_cast<int16_t>(acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc));
+        this->phase += this->down;
+        this->pos += this->phase / this->up;
+        this->phase %= this->up;
+      }
+
+      memmove(this->work, this->work + n, history * sizeof(int16_t));
+      this->pos -= n;
+      if (produced > 0) {
+        emit(static_cast<const int16_t*>(this->out), produced);
+      }
+      samples += n;
+      count -= n;
+    }
+  }
+
+private:
+  static constexpr size_t kChunk = 256;          // Input samples resampled per pass
+  static constexpr size_t kZeroCrossings = 8;    // Filter reach either side, in periods of the lower rate
+  static constexpr size_t kMinZeroCrossings = 2;
+  static constexpr size_t kMaxCoeffs = 8192;     // Filter table limit, 16 KB
+  static constexpr int kCoeffBits = 14;          // Q14, so a phase's gain can exceed 1 without overflow
+
+  static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+      uint32_t t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  size_t outputCapacity() const {
+    return kChunk * this->up / this->down + 2;
+  }
+
+  void release() {
+    delete[] this->coeffs;
+    delete[] this->work;
+    delete[] this->out;
+    this->coeffs = nullptr;
+    this->work = nullptr;
+    this->out = nullptr;
+    this->up = 0; // Neither passthrough nor a filter: unconfigured
+    this->down = 1;
+  }
+
+  int16_t* coeffs;  // [phase][tap]
+  int16_t* work;    // Filter history followed by the current chunk
+  int16_t* out;
+  uint32_t up;
+  uint32_t down;
+  size_t taps;
+  uint32_t phase;
+  size_t pos;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Prebuilt status lines
+#define RTSP_STATUS_OK "RTSP/1.0 200 OK\r\n"
+#define RTSP_STATUS_MOVED_TEMPORARILY "RTSP/1.0 302 Moved Temporarily\r\n"
+#define RTSP_STATUS_USE_PROXY "RTSP/1.0 305 Use Proxy\r\n"
+#define RTSP_STATUS_BAD_REQUEST "RTSP/1.0 400 Bad Request\r\n"
+#define RTSP_STATUS_UNAUTHORIZED "RTSP/1.0 401 Unauthorized\r\n"
+#define RTSP_STATUS_NOT_FOUND "RTSP/1.0 404 Not Found\r\n"
+#define RTSP_STATUS_NOT_ENOUGH_BANDWIDTH "RTSP/1.0 453 Not Enough Bandwidth\r\n"
+#define RTSP_STATUS_METHOD_NOT_VALID "RTSP/1.0 455 Method Not Valid In This State\r\n"
+#define RTSP_STATUS_AGGREGATE_NOT_ALLOWED "RTSP/1.0 459 Aggregate Operation Not Allowed\r\n"
+#define RTSP_STATUS_UNSUPPORTED_TRANSPORT "RTSP/1.0 461 Unsupported Transport\r\n"
+#define RTSP_STATUS_SERVICE_UNAVAILABLE "RTSP/1.0 503 Service Unavailable\r\n"
+
+/**
+ * @brief Fixed-size reply assembled from prebuilt header text.
+ *
+ * The constant parts of a reply are copied as they are; only CSeq, Session
+ * and the odd port number are formatted, with a plain integer conversion
+ * instead of snprintf. Output that does not fit is truncated.
+ */
+template <size_t Capacity>
+class RTSPResponse {
+public:
+  RTSPResponse() : len(0) {}
+
+  RTSPResponse& append(const char* text, size_t n) {
+    if (n > Capacity - this->len) {
+      n = Capacity - this->len;
+    }
+    memcpy(this->buf + this->len, text, n);
+    this->len += n;
+    return *this;
+  }
+
+  RTSPResponse& append(const char* text) {
+    return append(text, strlen(text));
+  }
+
+  RTSPResponse& appendUInt(uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+      digits[n++] = '0' + (value % 10);
+      value /= 10;
+    } while (value != 0);
+    while (n > 0 && this->len < Capacity) {
+      this->buf[this->len++] = digits[--n];
+    }
+    return *this;
+  }
+
+  // Status line, CSeq and the cached Date line every reply starts with
+  RTSPResponse& start(const char* statusLine, int cseq, const char* dateLine) {
+    append(statusLine);
+    append("CSeq: ");
+    appendUInt(static_cast<uint32_t>(cseq));
+    append("\r\n");
+    return append(dateLine);
+  }
+
+  RTSPResponse& session(uint32_t sessionID) {
+    append("Session: ");
+    appendUInt(sessionID);
+    return append("\r\n");
+  }
+
+  RTSPResponse& end() {
+    return append("\r\n");
+  }
+
+  const char* data() const {
+    return this->buf;
+  }
+
+  size_t size() const {
+    return this->len;
+  }
+
+private:
+  char buf[Capacity];
+  size_t len;
+};
@@ -0,0 +1,510 @@
+#pragma once
+
+// Included from ESP32-RTSPServer.h after RTSPServerBase is declared.
+
+#include <type_traits>
+
+/**
+ * @brief RTSP server specialized on a compile-time media/transport policy.
+ *
+ * Holds the per-packet send path: the fan-out around the payload formats in
+ * RTSPPayloadFormat.h and the optional sender tasks. Tracks and transports the policy leaves out are never
+ * instantiated, and the transport choice per packet folds away whenever the
+ * policy allows only one. RTSPServer is this template with RTSPDefaultPolicy.
+ */
+template <class Policy>
+class RTSPServerCore : public RTSPServerBase {
+public:
+  RTSPServerCore() : RTSPServerBase(RTSPMediaCaps{Policy::video, Policy::audio, Policy::subtitles, Policy::udp, Policy::multicast, Policy::tcp, Policy::httpTunnel, Policy::audioCodecs}) {}
+
+  void sendRTSPFrame(const uint8_t* data, size_t len, int quality, int width, int height, uint8_t mount = 0, int64_t captureUs = 0);
+
+  void sendRTSPAudio(int16_t* data, size_t len, int64_t captureUs = 0);
+
+  void sendRTSPSubtitles(char* data, size_t len, int64_t captureUs = 0);
+
+private:
+  static constexpr bool kTcpOnly = Policy::tcp && !Policy::udp && !Policy::multicast;
+
+  // How often a silence is refreshed with a comfort noise packet
+  static constexpr uint32_t kComfortNoiseIntervalMs = 500;
+
+#ifdef RTSP_DISABLE_DVI4
+  static_assert(!(Policy::audioCodecs & RTSPAudioCodecs::kDvi4), "RTSP_DISABLE_DVI4 leaves out the encoder state the policy's DVI4 needs");
+#endif
+#ifdef RTSP_DISABLE_OPUS
+  static_assert(!(Policy::audioCodecs & RTSPAudioCodecs::kOpus), "RTSP_DISABLE_OPUS leaves out the encoder the policy's Opus needs");
+#endif
+
+  // Whether the policy carries an RTSPAudioCodecs bit, as a type to overload on
+  template <uint8_t Codec>
+  using HasCodec = std::integral_constant<bool, (Policy::audioCodecs & Codec) != 0>;
+
+  static bool isTcpTarget(const RTSP_Sender& target) {
+    if (!Policy::tcp) {
+      return false;
+    }
+    return kTcpOnly || target.isTCP;
+  }
+
+  static bool isMulticastTarget(const RTSP_Sender& target) {
+    return Policy::multicast && target.isMulticast;
+  }
+
+  bool sendMediaPacket(uint8_t* packet, size_t packetSize, const RTSP_Sender& target, const RTSP_Track& track, uint8_t trackIndex);
+
+  template <class Format>
+  void sendTrack(int8_t trackIndex, const typename Format::Input& input);
+
+  void startMediaTasks(bool video, bool audio) override;
+
+  bool sendCachedFrame(const RTSP_Sender& target) override;
+
+  void sendVideoFrame(RTSP_Mount& feed, const RTSPJpegFormat::Input& input, uint32_t timestamp, RTSP_CachedFrame* frame);
+
+  bool replayFrame(RTSP_Mount& feed, const RTSP_Sender& target);
+
+  void sendAudioBlock(const int16_t* samples, size_t len, int64_t captureUs);
+
+  void syncAudioClock(int8_t trackIndex, RTSPAudioClockSync& clock, int64_t captureUs, size_t pending);
+
+  void sendAudioFrame(const int16_t* samples, size_t len);
+
+  void sendAudioPacket(int8_t trackIndex, RTSPAudioClockSync& clock, const int16_t* samples, size_t len, bool talkspurt);
+
+  template <class Format>
+  void sendAudioAs(int8_t trackIndex, const int16_t* samples, size_t len, bool talkspurt, std::true_type);
+
+  template <class Format>
+  void sendAudioAs(int8_t, const int16_t*, size_t, bool, std::false_type) {}
+
+  void sendAudioVariants(const int16_t* samples, size_t count, int64_t captureUs);
+
+  bool suppressSilence(const int16_t* samples, size_t count);
+
+  static void rtpVideoTaskWrapper(void* pvParameters);
+
+  void rtpVideoTask();
+
+  static void rtpAudioTaskWrapper(void* pvParameters);
+
+  void rtpAudioTask();
+};
+
+template <class Policy>
+void RTSPServerCore<Policy>::startMediaTasks(bool video, bool audio) {
+#ifdef RTSP_VIDEO_NONBLOCK
+  if (Policy::video && video && this->rtpVideoTaskHandle == NULL) {
+    xTaskCreate(rtpVideoTaskWrapper, "rtpVideoTask", RTP_STACK_SIZE, this, RTP_PRI, &this->rtpVideoTaskHandle);
+  }
+#endif
+#ifdef RTSP_AUDIO_NONBLOCK
+  if (Policy::audio && audio && this->rtpAudioTaskHandle == NULL) {
+    if (this->audioRing == NULL) {
+      this->audioRing = new RTSPServerAudioRing();
+    }
+    xTaskCreate(rtpAudioTaskWrapper, "rtpAudioTask", RTP_STACK_SIZE, this, RTP_PRI, &this->rtpAudioTaskHandle);
+  }
+#endif
+}
+
+template <class Policy>
+void RTSPServerCore<Policy>::rtpVideoTaskWrapper(void* pvParameters) {
+  RTSPServerCore* server = static_cast<RTSPServerCore*>(pvParameters);
+  server->rtpVideoTask();
+}
+
+template <class Policy>
+void RTSPServerCore<Policy>::rtpVideoTask() {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    for (uint8_t i = 0; i < this->mountCount; i++) {
+      RTSP_Mount& feed = this->mounts[i];
+      RTSP_CachedFrame* frame = feed.pendingFrame;
+      if (frame != NULL) {
+        sendVideoFrame(feed, {frame->data, frame->len, frame->quality, frame->width, frame->height}, frame->timestamp, frame);
+        feed.pendingFrame = NULL;
+      }
+    }
+    this->rtpFrameSent = true;
+  }
+  vTaskDelete(NULL);
+}
+
+template <class Policy>
+void RTSPServerCore<Policy>::rtpAudioTaskWrapper(void* pvParameters) {
+  RTSPServerCore* server = static_cast<RTSPServerCore*>(pvParameters);
+  server->rtpAudioTask();
+}
+
+template <class Policy>
+void RTSPServerCore<Policy>::rtpAudioTask() {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Drain everything queued since the last wake-up
+    while (const auto* block = this->audioRing->front()) {
+      sendAudioBlock(block->samples, block->len, block->captureUs);
+      this->audioRing->pop();
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Sends a JPEG frame to the mount's viewers.
+ *
+ * captureUs is the media time the frame was taken, e.g. from
+ * camera_fb_t::timestamp; without it the frame is stamped when it is passed
+ * in, so any delay between capture and this call shows up as jitter.
+ */
+template <class Policy>
+void RTSPServerCore<Policy>::sendRTSPFrame(const uint8_t* data, size_t len, int quality, int width, int height, uint8_t mount, int64_t captureUs) {
+  static_assert(Policy::video, "sendRTSPFrame needs a policy with video");
+  if (mount >= this->mountCount || this->mounts[mount].videoTrack < 0) {
+    return;
+  }
+  RTSP_Mount& feed = this->mounts[mount];
+  this->rtpFrameSent = false;
+  uint32_t currentTime = millis(); // Get the current time in milliseconds
+  // Applied to the track only by whoever sends the frame, so a frame in flight keeps its own
+  uint32_t timestamp = RTSPMediaClock::toRtp(captureUs != 0 ? captureUs : esp_timer_get_time(), 90000);
+
+  // Work out the RTP sent FPS of the main stream to use for subtitles
+  if (mount == 0) {
+    this->rtpFrameCount++;
+    // Update FPS every second
+    if (currentTime - this->lastRtpFPSUpdateTime >= 1000) {
+      this->rtpFps = this->rtpFrameCount; // Store the current FPS
+      this->rtpFrameCount = 0; // Reset the frame count for the next second
+      this->lastRtpFPSUpdateTime = currentTime; // Update the last FPS update time
+    }
+  }
+#ifdef RTSP_VIDEO_NONBLOCK
+  // Copy into a cache slot; the video task sends from it and then keeps it
+  // as the last frame, so there is no second copy
+  if (feed.pendingFrame == NULL && len <= MAX_RTSP_BUFFER && this->rtpVideoTaskHandle != NULL) {
+    RTSP_CachedFrame* frame = feed.frames.beginWrite(len);
+    if (frame != NULL) {
+      memcpy(frame->data, data, len);
+      frame->len = len;
+      frame->quality = quality;
+      frame->width = width;
+      frame->height = height;
+      frame->timestamp = timestamp;
+      feed.pendingFrame = frame;
+      xTaskNotifyGive(rtpVideoTaskHandle);
+    }
+  }
+#else
+  // Sent straight from the caller's buffer; only instant start keeps a copy
+  RTSP_CachedFrame* frame = NULL;
+#ifdef RTSP_INSTANT_START
+  if (len <= MAX_RTSP_BUFFER) {
+    frame = feed.frames.beginWrite(len);
+  }
+  if (frame != NULL) {
+    memcpy(frame->data, data, len);
+    frame->len = len;
+    frame->quality = quality;
+    frame->width = width;
+    frame->height = height;
+  }
+#endif
+  sendVideoFrame(feed, {data, len, static_cast<uint8_t>(quality), static_cast<uint16_t>(width), static_cast<uint16_t>(height)}, timestamp, frame);
+  this->rtpFrameSent = true;
+#endif
+}
+
+/**
+ * @brief Sends a mount's frame to every subscriber and, when it was copied
+ * into a cache slot, keeps it with its RTP state as the frame new viewers
+ * get first.
+ */
+template <class Policy>
+void RTSPServerCore<Policy>::sendVideoFrame(RTSP_Mount& feed, const RTSPJpegFormat::Input& input, uint32_t timestamp, RTSP_CachedFrame* frame) {
+  this->tracks[feed.videoTrack].stream.timestamp = timestamp;
+  if (frame != NULL) {
+    frame->stream = this->tracks[feed.videoTrack].stream;
+  }
+  this->template sendTrack<RTSPJpegFormat>(feed.videoTrack, input);
+  if (frame != NULL) {
+    feed.frames.publish(frame);
+  }
+}
+
+/**
+ * @brief Replays the last frame of every mount the session set up video on,
+ * so the first picture does not wait for the next capture.
+ *
+ * @return true if a frame was sent.
+ */
+template <class Policy>
+bool RTSPServerCore<Policy>::sendCachedFrame(const RTSP_Sender& target) {
+#ifndef RTSP_INSTANT_START
+  return false;
+#else
+  // A frame is far bigger than what a TCP connection can take without waiting, which the control task must not do
+  if (!Policy::video || isMulticastTarget(target) || isTcpTarget(target)) {
+    return false;
+  }
+  bool delivered = false;
+  for (uint8_t i = 0; i < this->mountCount; i++) {
+    int8_t trackIndex = this->mounts[i].videoTrack;
+    if (trackIndex >= 0 && (target.trackMask & (1 << trackIndex))) {
+      delivered = replayFrame(this->mounts[i], target) || delivered;
+    }
+  }
+  return delivered;
+#endif
+}
+
+/**
+ * @brief Sends a mount's cached frame to one session about to start playing.
+ *
+ * The frame goes out with the RTP state it was sent live with, kept in its
+ * slot, so the viewer sees it as the frame before the live stream picks
+ * up. Nothing the video task updates is read. Only UDP unicast viewers get it: the caller skips
+ * multicast, which the group already gets live, and TCP, which would hold
+ * up the control task.
+ */
+template <class Policy>
+bool RTSPServerCore<Policy>::replayFrame(RTSP_Mount& feed, const RTSP_Sender& target) {
+  RTSP_CachedFrame* frame = feed.frames.acquire();
+  if (frame == NULL) {
+    return false;
+  }
+
+  RTSP_Track track = RTSP_Track();
+  track.format = &RTSPJpegFormat::info;
+  track.unicastSocket = this->tracks[feed.videoTrack].unicastSocket;
+  track.stream = frame->stream;
+  bool delivered = true;
+  uint8_t packet[RTSPPacket::kPayloadOffset + RTSPJpegFormat::headerSize + RTSPJpegFormat::maxPayload];
+  RTSPJpegFormat::packetize({frame->data, frame->len, frame->quality, frame->width, frame->height}, track, packet, [&](size_t packetSize) {
+    // Stop at the first drop; the rest of the frame would be useless
+    if (delivered) {
+      delivered = this->sendMediaPacket(packet, packetSize, target, track, feed.videoTrack);
+    }
+  });
+  feed.frames.release(frame);
+  return delivered;
+}
+
+/**
+ * @brief Sends a block of PCM audio to the viewers.
+ *
+ * captureUs is the media time of the block's first sample, e.g. taken when
+ * the I2S read that filled it began; without it the block is taken to end
+ * now. It keeps the audio timestamps on the clock the video is stamped
+ * with, however far the microphone's sample rate is off.
+ */
+template <class Policy>
+void RTSPServerCore<Policy>::sendRTSPAudio(int16_t* data, size_t len, int64_t captureUs) {
+  static_assert(Policy::audio, "sendRTSPAudio needs a policy with audio");
+  if (captureUs == 0 && this->sampleRate != 0) {
+    captureUs = esp_timer_get_time() - static_cast<int64_t>(len / 2) * 1000000 / this->sampleRate;
+  }
+#ifdef RTSP_AUDIO_NONBLOCK
+  // Hand the block to the audio task; the capture loop never waits on the network
+  if (this->rtpAudioTaskHandle != NULL) {
+    this->audioRing->push(data, len, captureUs);
+    xTaskNotifyGive(this->rtpAudioTaskHandle);
+  }
+#else
+  this->rtpAudioSent = false;
+  sendAudioBlock(data, len, captureUs);
+  this->rtpAudioSent = true;
+#endif
+}
+
+// Sends a PCM block as packets of audioPtime each, carrying what is left over to the next block
+template <class Policy>
+void RTSPServerCore<Policy>::sendAudioBlock(const int16_t* samples, size_t len, int64_t captureUs) {
+  if (this->audioTrack < 0) {
+    return;
+  }
+  if (captureUs != 0) {
+    syncAudioClock(this->audioTrack, this->audioClock, captureUs, this->audioFramer.pending());
+  }
+  this->audioFramer.push(samples, len / 2, [this](const int16_t* frame, size_t count) {
+    sendAudioFrame(frame, count * 2);
+  });
+  if (this->mountCount > 1) {
+    sendAudioVariants(samples, len / 2, captureUs);
+  }
+}
+
+/**
+ * @brief Compares an audio track's next timestamp with the media clock.
+ *
+ * pending is the samples still held by the framer, which go out ahead of
+ * the block captured at captureUs. clock is kept next to the track's framer.
+ */
+template <class Policy>
+void RTSPServerCore<Policy>::syncAudioClock(int8_t trackIndex, RTSPAudioClockSync& clock, int64_t captureUs, size_t pending) {
+  RTSP_Track& track = this->tracks[trackIndex];
+  uint32_t expected = RTSPMediaClock::toRtp(captureUs, track.clockRate) - static_cast<uint32_t>(pending * track.ticksPerSample);
+  track.stream.timestamp += clock.observe(static_cast<int32_t>(expected - track.stream.timestamp), track.clockRate);
+}
+
+/**
+ * @brief Feeds the audio of every addAudioMount() variant. Each sample rate
+ * is resampled once, by its first variant, and shared with the rest.
+ */
+template <class Policy>
+void RTSPServerCore<Policy>::sendAudioVariants(const int16_t* samples, size_t count, int64_t captureUs) {
+  for (uint8_t i = 1; i < this->mountCount; i++) {
+    RTSP_Mount& source = this->mounts[i];
+    if (source.audioTrack < 0) {
+      continue;
+    }
+    bool resampled = false;
+    for (uint8_t j = 1; j < i && !resampled; j++) {
+      resampled = this->mounts[j].audioTrack >= 0 && this->mounts[j].audioRate == source.audioRate;
+    }
+    if (resampled) {
+      continue;
+    }
+    for (uint8_t k = i; k < this->mountCount && captureUs != 0; k++) {
+      RTSP_Mount& feed = this->mounts[k];
+      if (feed.audioTrack >= 0 && feed.audioRate == source.audioRate) {
+        syncAudioClock(feed.audioTrack, feed.audioClock, captureUs, feed.audioFramer.pending());
+      }
+    }
+    source.resampler.process(samples, count, [this, i, &source](const int16_t* out, size_t outCount) {
+      for (uint8_t k = i; k < this->mountCount; k++) {
+        RTSP_Mount& feed = this->mounts[k];
+        if (feed.audioTrack < 0 || feed.audioRate != source.audioRate) {
+          continue;
+        }
+        feed.audioFramer.push(out, outCount, [this, &feed](const int16_t* frame, size_t frameCount) {
+          sendAudioPacket(feed.audioTrack, feed.audioClock, frame, frameCount * 2, feed.audioTalkspurt);
+          feed.audioTalkspurt = false;
+        });
+      }
+    });
+  }
+}
+
+// Sends one frame of the main audio track, unless it is left out as silence
+template <class Policy>
+void RTSPServerCore<Policy>::sendAudioFrame(const int16_t* samples, size_t len) {
+  if (this->silenceMode != RTSPServerBase::SILENCE_SEND && suppressSilence(samples, len / 2)) {
+    return;
+  }
+  bool talkspurt = this->audioTalkspurt;
+  this->audioTalkspurt = false;
+  sendAudioPacket(this->audioTrack, this->audioClock, samples, len, talkspurt);
+}
+
+// Packetizes PCM in the codec the audio track was registered with
+template <class Policy>
+void RTSPServerCore<Policy>::sendAudioPacket(int8_t trackIndex, RTSPAudioClockSync& clock, const int16_t* samples, size_t len, bool talkspurt) {
+  this->tracks[trackIndex].stream.timestamp += clock.correction();
+  sendAudioAs<RTSPL16Format>(trackIndex, samples, len, talkspurt, HasCodec<RTSPAudioCodecs::kL16>());
+  sendAudioAs<RTSPPcmuFormat>(trackIndex, samples, len, talkspurt, HasCodec<RTSPAudioCodecs::kPcmu>());
+  sendAudioAs<RTSPPcmaFormat>(trackIndex, samples, len, talkspurt, HasCodec<RTSPAudioCodecs::kPcma>());
+  sendAudioAs<RTSPDvi4Format>(trackIndex, samples, len, talkspurt, HasCodec<RTSPAudioCodecs::kDvi4>());
+  sendAudioAs<RTSPOpusFormat>(trackIndex, samples, len, talkspurt, HasCodec<RTSPAudioCodecs::kOpus>());
+}
+
+// Sends as Format if the track uses it; codecs the policy leaves out take the empty overload and are never instantiated
+template <class Policy>
+template <class Format>
+void RTSPServerCore<Policy>::sendAudioAs(int8_t trackIndex, const int16_t* samples, size_t len, bool talkspurt, std::true_type) {
+  if (this->tracks[trackIndex].format == &Format::info) {
+    this->template sendTrack<Format>(trackIndex, {samples, len, talkspurt});
+  }
+}
+
+/**
+ * @brief Decides whether a frame is left out as silence. Suppressed frames
+ * still advance the RTP clock, so the next talkspurt lands at the right time;
+ * it starts with the marker bit set.
+ */
+template <class Policy>
+bool RTSPServerCore<Policy>::suppressSilence(const int16_t* samples, size_t count) {
+  if (this->voiceDetector.isActive(samples, count)) {
+    if (this->audioSilent) {
+      this->audioSilent = false;
+      this->audioTalkspurt = true;
+    }
+    return false;
+  }
+
+  RTSP_Track& track = this->tracks[this->audioTrack];
+  if (track.comfortNoise &&
+      (!this->audioSilent || this->silentSamples >= this->sampleRate * kComfortNoiseIntervalMs / 1000)) {
+    this->template sendTrack<RTSPComfortNoiseFormat>(this->audioTrack, {this->voiceDetector.noiseLevel()});
+    this->silentSamples = 0;
+  }
+  this->audioSilent = true;
+  this->silentSamples += count;
+  track.stream.timestamp += count * track.ticksPerSample;
+  return true;
+}
+
+template <class Policy>
+void RTSPServerCore<Policy>::sendRTSPSubtitles(char* data, size_t len, int64_t captureUs) {
+  static_assert(Policy::subtitles, "sendRTSPSubtitles needs a policy with subtitles");
+  if (this->subtitlesTrack >= 0) {
+    this->tracks[this->subtitlesTrack].stream.timestamp = RTSPMediaClock::toRtp(captureUs != 0 ? captureUs : esp_timer_get_time(), RTSPT140Format::clockRate);
+  }
+  this->rtpSubtitlesSent = false;
+  sendTrack<RTSPT140Format>(this->subtitlesTrack, {data, len});
+  this->rtpSubtitlesSent = true;
+}
+
+template <class Policy>
+template <class Format>
+void RTSPServerCore<Policy>::sendTrack(int8_t trackIndex, const typename Format::Input& input) {
+  if (trackIndex < 0) {
+    return;
+  }
+  RTSP_Track& track = this->tracks[trackIndex];
+  const uint8_t trackBit = 1 << trackIndex;
+
+  // Each packet is built once and the same bytes go to every subscriber
+  const SubscriberList* subscribers = this->subscribers.acquire();
+  if (subscribers->count > 0) {
+    // Word-aligned so the payload, at a word offset, can be filled a word at a time
+    alignas(4) uint8_t packet[RTSPPacket::kPayloadOffset + Format::headerSize + Format::maxPayload];
+    uint32_t wireBytes = 0;
+    Format::packetize(input, track, packet, [&](size_t packetSize) {
+      for (size_t i = 0; i < subscribers->count; i++) {
+        const RTSP_Sender& target = subscribers->entries[i];
+        if (target.trackMask & trackBit) {
+          this->sendMediaPacket(packet, packetSize, target, track, trackIndex);
+        }
+      }
+      wireBytes += packetSize - RTSPPacket::kInterleavedHeaderSize + RTSPBandwidth::kUdpIpOverhead;
+    });
+    // What one UDP viewer of this track costs, for admission
+    this->trackRates[trackIndex].add(wireBytes, millis());
+    for (size_t i = 0; i < subscribers->count; i++) {
+      if (subscribers->entries[i].awaitingFirstRtp && (subscribers->entries[i].trackMask & trackBit)) {
+        this->noteFirstRtp(trackBit);
+        break;
+      }
+    }
+  }
+  this->subscribers.release(subscribers);
+}
+
+template <class Policy>
+bool RTSPServerCore<Policy>::sendMediaPacket(uint8_t* packet, size_t packetSize, const RTSP_Sender& target, const RTSP_Track& track, uint8_t trackIndex) {
+  // Send packet using TCP or UDP
+  if (isTcpTarget(target)) {
+    // The packet is shared by every receiver; only the channel differs
+    packet[1] = target.channels[trackIndex];
+    // Audio and text jump ahead of video fragments still to be sent on the connection
+    return this->sendTcpPacket(packet, packetSize, target, track.format != &RTSPJpegFormat::info);
+  } else if (Policy::udp || Policy::multicast) {
+    if (isMulticastTarget(target)) {
+      this->sendRtpDatagram(track.multicastSocket, packet + RTSPPacket::kInterleavedHeaderSize, packetSize - RTSPPacket::kInterleavedHeaderSize, target, track.serverPort);
+    } else {
+      this->sendRtpDatagram(track.unicastSocket, packet + RTSPPacket::kInterleavedHeaderSize, packetSize - RTSPPacket::kInterleavedHeaderSize, target, target.clientPorts[trackIndex]);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "LaxRTSPSession.h"
+#include "RTSPBase64.h"
+#include "RTSPPayloadFormat.h"
+
+#define MAX_COOKIE_LENGTH 128 // max length of session cookie
+
+/**
+ * @brief Per-packet state of a session, read by the sender loops.
+ *
+ * Kept in its own array, apart from the control data in RTSP_Session, so a
+ * fan-out walks a few contiguous cache lines instead of map nodes.
+ */
+struct RTSP_Sender {
+  bool isPlaying;
+  bool isMulticast;
+  bool isTCP;
+  int sock;           // Socket media is written to (the GET socket for HTTP tunnels)
+  uint32_t peerAddr;  // Unicast destination in network order, resolved at SETUP
+  uint8_t trackMask;  // Bit per track this session has SETUP
+  uint16_t outSlot;   // Session holding the output buffer for sock
+  uint16_t clientPorts[RTSP_MAX_TRACKS];
+  uint8_t channels[RTSP_MAX_TRACKS];  // Interleaved RTP channel per track, negotiated at SETUP
+  bool awaitingFirstRtp;  // Playing, first packet not sent yet; the senders report when it goes out
+};
+
+struct RTSP_Session {
+  uint32_t sessionID;
+  int sock;
+  int cseq;
+  bool isHttp;  // Add flag for HTTP tunneling
+  int httpSock;  // Add HTTP socket storage
+  char sessionCookie[MAX_COOKIE_LENGTH];  // Add storage for session cookie
+  uint32_t cookieHash;  // Key in the pool's cookie index
+  bool cookieIndexed;
+  LaxRTSPState laxState;
+  int8_t profile;         // Index into the server's client profiles, -1 if unknown
+  uint8_t mount;          // Index into the server's mounts, from the last DESCRIBE or SETUP URL
+  uint32_t acceptTime;    // millis() when the connection was accepted
+  bool hasPlayed;         // Started playing before, so it has had live media and gets no replay
+  bool refused;           // Accepted over the client limit; its first request gets 503 and the connection closes
+  uint16_t inLen;      // Bytes buffered in inBuf
+  uint16_t inScanned;  // Bytes of the pending message already searched for the end of headers
+  char inBuf[RTSP_INPUT_BUFFER_SIZE];  // Request input, parsed in place
+  bool base64Input;    // Input is the base64 body of a tunnel POST
+  RTSPBase64Decoder base64;  // Carries partial quanta between reads
+  bool inputPaused;    // Parsing waits for the reply socket to drain
+  uint8_t watchedEvents;  // What the event loop watches the socket for
+  uint16_t replySlot;  // Session whose socket replies go out on (the GET side of a tunnel)
+  bool inputWaiting;   // Some session's input waits for this output buffer to drain
+  uint16_t outLen;     // Bytes queued in outBuf, guarded by sendTcpMutex
+  char outBuf[RTSP_OUTPUT_BUFFER_SIZE];  // Output the socket has not taken yet
+  uint16_t priorityLen;  // Bytes queued in priorityBuf, guarded by sendTcpMutex
+  char* priorityBuf;     // Whole audio packets to go out before the next video packet; allocated for interleaved connections only
+  uint16_t slot;        // Index into the pool, also indexes the sender array
+  uint16_t generation;  // Bumped on every release so stale handles stop resolving
+  bool inUse;
+};
+
+/**
+ * @brief Stable reference to a pooled session that survives slot reuse checks.
+ */
+struct RTSP_SessionHandle {
+  uint16_t slot;
+  uint16_t generation;
+};
+
+/**
+ * @brief Open-addressing map from a 32-bit key to a pool slot.
+ *
+ * Linear probing with backward-shift deletion, so lookups stay short after
+ * churn instead of wading through tombstones. Keys may collide; find() takes
+ * a predicate that confirms the candidate slot.
+ */
+template <size_t Buckets>
+class RTSPSlotIndex {
+  static_assert(Buckets > 0 && (Buckets & (Buckets - 1)) == 0, "Buckets must be a power of two");
+
+public:
+  static constexpr uint16_t kNone = 0xFFFF;
+
+  RTSPSlotIndex() {
+    for (size_t i = 0; i < Buckets; i++) {
+      this->slots[i] = kNone;
+    }
+  }
+
+  void insert(uint32_t key, uint16_t slot) {
+    size_t i = bucket(key);
+    while (this->slots[i] != kNone) {
+      i = (i + 1) & (Buckets - 1);
+    }
+    this->keys[i] = key;
+    this->slots[i] = slot;
+  }
+
+  template <class Match>
+  uint16_t find(uint32_t key, Match&& match) const {
+    for (size_t i = bucket(key); this->slots[i] != kNone; i = (i + 1) & (Buckets - 1)) {
+      if (this->keys[i] == key && match(this->slots[i])) {
+        return this->slots[i];
+      }
+    }
+    return kNone;
+  }
+
+  void erase(uint32_t key, uint16_t slot) {
+    size_t hole = bucket(key);
+    while (this->slots[hole] != kNone && !(this->keys[hole] == key && this->slots[hole] == slot)) {
+      hole = (hole + 1) & (Buckets - 1);
+    }
+    if (this->slots[hole] == kNone) {
+      return;
+    }
+    // Pull later entries of the probe run back over the hole
+    for (size_t j = (hole + 1) & (Buckets - 1); this->slots[j] != kNone; j = (j + 1) & (Buckets - 1)) {
+      size_t home = bucket(this->keys[j]);
+      bool movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+      if (movable) {
+        this->keys[hole] = this->keys[j];
+        this->slots[hole] = this->slots[j];
+        hole = j;
+      }
+    }
+    this->slots[hole] = kNone;
+  }
+
+private:
+  static size_t bucket(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    return key & (Buckets - 1);
+  }
+
+  uint32_t keys[Buckets];
+  uint16_t slots[Buckets];
+};
+
+// Smallest power of two holding twice the entries, keeping probe runs short
+constexpr size_t rtspIndexBuckets(size_t entries, size_t buckets = 1) {
+  return buckets >= entries * 2 ? buckets : rtspIndexBuckets(entries, buckets * 2);
+}
+
+/**
+ * @brief Preallocated session storage with stable slots.
+ *
+ * Sessions are never copied after acquire(); handlers work on the slot in
+ * place. The hot sender fields live in a parallel array indexed by slot.
+ * Free slots are kept on a stack and sessions are indexed by ID and tunnel
+ * cookie, so accept and lookup cost does not grow with the connection count.
+ */
+template <size_t Capacity>
+class RTSPSessionPool {
+  static_assert(Capacity < RTSPSlotIndex<1>::kNone, "Slot numbers must fit in uint16_t");
+
+public:
+  RTSPSessionPool() : highWater(0), freeCount(0) {
+    for (size_t i = 0; i < Capacity; i++) {
+      this->senders[i] = RTSP_Sender();
+      this->slots[i].slot = static_cast<uint16_t>(i);
+      this->slots[i].generation = 0;
+      this->slots[i].inUse = false;
+      this->slots[i].priorityBuf = nullptr;
+      clear(this->slots[i]);
+    }
+    // Hand out low slots first so highWater stays tight
+    for (size_t i = Capacity; i > 0; i--) {
+      this->freeSlots[this->freeCount++] = static_cast<uint16_t>(i - 1);
+    }
+  }
+
+  RTSP_Session* acquire(uint32_t sessionID, int sock) {
+    if (this->freeCount == 0) {
+      return nullptr;
+    }
+    uint16_t i = this->freeSlots[--this->freeCount];
+    RTSP_Session& session = this->slots[i];
+    clear(session);
+    session.sessionID = sessionID;
+    session.sock = sock;
+    session.replySlot = i;
+    session.watchedEvents = 0x01;  // Readable, as registered on accept
+    session.inUse = true;
+    this->idIndex.insert(sessionID, i);
+
+    RTSP_Sender& sender = this->senders[i];
+    sender = RTSP_Sender();
+    sender.sock = sock;
+    sender.outSlot = i;
+
+    if (i + 1u > this->highWater) {
+      this->highWater = i + 1u;
+    }
+    return &session;
+  }
+
+  void release(RTSP_Session& session) {
+    this->senders[session.slot].isPlaying = false;
+    this->idIndex.erase(session.sessionID, session.slot);
+    if (session.cookieIndexed) {
+      this->cookieIndex.erase(session.cookieHash, session.slot);
+      session.cookieIndexed = false;
+    }
+    session.inUse = false;
+    session.generation++;
+    this->freeSlots[this->freeCount++] = session.slot;
+    while (this->highWater > 0 && !this->slots[this->highWater - 1].inUse) {
+      this->highWater--;
+    }
+  }
+
+  RTSP_Session* find(uint32_t sessionID) {
+    uint16_t slot = this->idIndex.find(sessionID, [&](uint16_t candidate) {
+      return this->slots[candidate].inUse && this->slots[candidate].sessionID == sessionID;
+    });
+    return slot != RTSPSlotIndex<1>::kNone ? &this->slots[slot] : nullptr;
+  }
+
+  // Makes the session findable by its tunnel cookie (the GET side of a tunnel)
+  void indexCookie(RTSP_Session& session) {
+    if (session.cookieIndexed || session.sessionCookie[0] == '\0') {
+      return;
+    }
+    session.cookieHash = cookieHash(session.sessionCookie);
+    session.cookieIndexed = true;
+    this->cookieIndex.insert(session.cookieHash, session.slot);
+  }
+
+  RTSP_Session* findByCookie(const char* cookie) {
+    if (cookie == nullptr || cookie[0] == '\0') {
+      return nullptr;
+    }
+    uint16_t slot = this->cookieIndex.find(cookieHash(cookie), [&](uint16_t candidate) {
+      return this->slots[candidate].inUse && strcmp(this->slots[candidate].sessionCookie, cookie) == 0;
+    });
+    return slot != RTSPSlotIndex<1>::kNone ? &this->slots[slot] : nullptr;
+  }
+
+  RTSP_SessionHandle handle(const RTSP_Session& session) const {
+    return RTSP_SessionHandle{session.slot, session.generation};
+  }
+
+  RTSP_Session* resolve(RTSP_SessionHandle handle) {
+    if (handle.slot >= Capacity) {
+      return nullptr;
+    }
+    RTSP_Session& session = this->slots[handle.slot];
+    return (session.inUse && session.generation == handle.generation) ? &session : nullptr;
+  }
+
+  RTSP_Session& at(size_t slot) { return this->slots[slot]; }
+
+  RTSP_Sender& sender(const RTSP_Session& session) { return this->senders[session.slot]; }
+
+  const RTSP_Sender* senderArray() const { return this->senders; }
+
+  // Slots past this index are all free, so loops can stop early
+  size_t size() const { return this->highWater; }
+
+  bool anyPlaying() const {
+    for (size_t i = 0; i < this->highWater; i++) {
+      if (this->senders[i].isPlaying) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static constexpr size_t kBuckets = rtspIndexBuckets(Capacity);
+
+  // Resets a slot's per-connection state in place; a temporary RTSP_Session
+  // would take several KB of the accepting task's stack. The buffers are
+  // only cleared by length, and slot, generation and priorityBuf are kept.
+  static void clear(RTSP_Session& session) {
+    session.sessionID = 0;
+    session.sock = -1;
+    session.cseq = 0;
+    session.isHttp = false;
+    session.httpSock = -1;
+    session.sessionCookie[0] = '\0';
+    session.cookieHash = 0;
+    session.cookieIndexed = false;
+    LaxRTSPSession::reset(session.laxState);
+    session.profile = -1;
+    session.mount = 0;
+    session.acceptTime = 0;
+    session.hasPlayed = false;
+    session.refused = false;
+    session.inLen = 0;
+    session.inScanned = 0;
+    session.base64Input = false;
+    session.base64.reset();
+    session.inputPaused = false;
+    session.watchedEvents = 0;
+    session.replySlot = session.slot;
+    session.inputWaiting = false;
+    session.outLen = 0;
+    session.priorityLen = 0;
+  }
+
+  // FNV-1a
+  static uint32_t cookieHash(const char* cookie) {
+    uint32_t hash = 2166136261u;
+    while (*cookie) {
+      hash = (hash ^ static_cast<uint8_t>(*cookie++)) * 16777619u;
+    }
+    return hash;
+  }
+
+  RTSP_Sender senders[Capacity];
+  RTSP_Session slots[Capacity];
+  uint16_t freeSlots[Capacity];
+  RTSPSlotIndex<kBuckets> idIndex;
+  RTSPSlotIndex<kBuckets> cookieIndex;
+  size_t highWater;
+  size_t freeCount;
+};
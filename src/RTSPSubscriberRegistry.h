@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "RTSPSessionPool.h"
+
+/**
+ * @brief Immutable list of the sessions currently receiving media.
+ *
+ * Holds copies of the sender state, so readers never touch the session pool.
+ * At most one multicast entry is kept since the group only needs one copy.
+ */
+template <size_t Capacity>
+struct RTSP_SubscriberList {
+  size_t count;
+  RTSP_Sender entries[Capacity];
+};
+
+/**
+ * @brief Read-copy-update registry of subscriber lists.
+ *
+ * Only the control task writes: it fills a spare list and publishes it with a
+ * single atomic store. Sender tasks pin the current list with acquire() and
+ * unpin it with release(), without taking a lock. synchronize() waits until
+ * no sender still holds an older list, after which sockets that were only
+ * reachable through it can be closed.
+ */
+template <size_t Capacity>
+class RTSPSubscriberRegistry {
+public:
+  typedef RTSP_SubscriberList<Capacity> List;
+
+  RTSPSubscriberRegistry() : current(0), pending(0) {
+    for (size_t i = 0; i < kLists; i++) {
+      this->lists[i].count = 0;
+      this->readers[i].store(0);
+    }
+  }
+
+  const List* acquire() {
+    while (true) {
+      uint32_t index = this->current.load(std::memory_order_acquire);
+      this->readers[index].fetch_add(1, std::memory_order_acq_rel);
+      // The writer may have moved on between the load and the pin; retry so we
+      // never read a list that is being refilled.
+      if (this->current.load(std::memory_order_acquire) == index) {
+        return &this->lists[index];
+      }
+      this->readers[index].fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  void release(const List* list) {
+    this->readers[list - this->lists].fetch_sub(1, std::memory_order_release);
+  }
+
+  // Control task only: returns a list no reader can see, ready to be filled.
+  List& beginUpdate() {
+    uint32_t active = this->current.load(std::memory_order_relaxed);
+    while (true) {
+      for (uint32_t i = 0; i < kLists; i++) {
+        if (i != active && this->readers[i].load(std::memory_order_acquire) == 0) {
+          this->pending = i;
+          this->lists[i].count = 0;
+          return this->lists[i];
+        }
+      }
+      vTaskDelay(1);
+    }
+  }
+
+  void publish() {
+    this->current.store(this->pending, std::memory_order_release);
+  }
+
+  // Control task only: blocks until every reader has left the older lists.
+  void synchronize() {
+    uint32_t active = this->current.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < kLists; i++) {
+      if (i == active) {
+        continue;
+      }
+      while (this->readers[i].load(std::memory_order_acquire) != 0) {
+        vTaskDelay(1);
+      }
+    }
+  }
+
+private:
+  static const uint32_t kLists = 3;
+
+  List lists[kLists];
+  std::atomic<uint32_t> readers[kLists];
+  std::atomic<uint32_t> current;
+  uint32_t pending;
+};
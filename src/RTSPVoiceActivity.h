@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Energy-based voice activity detector with hangover.
+ *
+ * Each frame's mean square is compared against a noise floor that follows
+ * the quietest frames quickly and louder ones only slowly, so steady room
+ * noise counts as silence while speech stands out from it. Once speech
+ * stops, frames stay active for the hangover so word endings and short
+ * pauses are not clipped.
+ */
+class RTSPVoiceDetector {
+public:
+  RTSPVoiceDetector() : noiseFloor(0), lastEnergy(0), hangoverSamples(0), hangoverLeft(0) {}
+
+  void configure(uint32_t sampleRate, uint16_t hangoverMs) {
+    this->hangoverSamples = sampleRate * hangoverMs / 1000;
+    this->noiseFloor = 0;
+    this->lastEnergy = 0;
+    this->hangoverLeft = 0;
+  }
+
+  // True while the frame holds speech or the hangover after speech runs
+  bool isActive(const int16_t* samples, size_t count) {
+    if (count == 0) {
+      return this->hangoverLeft > 0;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      int32_t s = samples[i];
+      sum += static_cast<uint32_t>(s * s);
+    }
+    uint32_t energy = static_cast<uint32_t>(sum / count);
+    this->lastEnergy = energy;
+
+    if (this->noiseFloor == 0 || energy < this->noiseFloor) {
+      this->noiseFloor = energy > kMinEnergy ? energy : kMinEnergy;
+    } else {
+      this->noiseFloor += ((energy - this->noiseFloor) >> kFloorRiseShift) + 1;
+    }
+
+    if (energy > kMinEnergy && energy / kSpeechRatio > this->noiseFloor) {
+      this->hangoverLeft = this->hangoverSamples;
+      return true;
+    }
+    if (this->hangoverLeft >= count) {
+      this->hangoverLeft -= count;
+      return true;
+    }
+    this->hangoverLeft = 0;
+    return false;
+  }
+
+  // Level of the last frame in -dBov (0 to 127), as RFC 3389 comfort noise carries it
+  uint8_t noiseLevel() const {
+    if (this->lastEnergy == 0) {
+      return 127;
+    }
+    // A full-scale square wave is 0 dBov
+    float dBov = 10.0f * log10f(static_cast<float>(this->lastEnergy) / (32767.0f * 32767.0f));
+    return dBov <= -127.0f ? 127 : static_cast<uint8_t>(-dBov);
+  }
+
+private:
+  static constexpr uint32_t kMinEnergy = 64;     // RMS of 8, below which nothing is speech
+  static constexpr uint32_t kSpeechRatio = 8;     // 9 dB above the noise floor
+  static constexpr uint8_t kFloorRiseShift = 9;  // Floor follows louder frames over hundreds of frames
+
+  uint32_t noiseFloor;
+  uint32_t lastEnergy;
+  uint32_t hangoverSamples;
+  uint32_t hangoverLeft;
+};
@@ -1,8 +1,8 @@
 #include "ESP32-RTSPServer.h"
+#include "LaxRTSPCompat.h"
 #include "libb64/cencode.h" // Include libb64 library
-#include "libb64/cdecode.h" // Include libb64 library for decoding
 
-void RTSPServer::startSubtitlesTimer(esp_timer_cb_t userCallback) { 
+void RTSPServerBase::startSubtitlesTimer(esp_timer_cb_t userCallback) { 
   const esp_timer_create_args_t timerConfig = { 
     .callback = userCallback, // User-defined callback function 
     .arg = nullptr, // Optional argument, can be set to NULL
@@ -14,7 +14,7 @@ void RTSPServer::startSubtitlesTimer(esp_timer_cb_t userCallback) {
     esp_timer_start_periodic(sendSubtitlesTimer, 1000000); 
 }
 
-void RTSPServer::setMaxClients(uint8_t newMaxClients) {
+void RTSPServerBase::setMaxClients(uint16_t newMaxClients) {
   if (xSemaphoreTake(maxClientsMutex, portMAX_DELAY) == pdTRUE) {
     if (newMaxClients <= MAX_CLIENTS) {
       this->maxClients = newMaxClients;
@@ -29,8 +29,8 @@ void RTSPServer::setMaxClients(uint8_t newMaxClients) {
   }
 }
 
-uint8_t RTSPServer::getMaxClients() {
-  uint8_t clients = 0;
+uint16_t RTSPServerBase::getMaxClients() {
+  uint16_t clients = 0;
   if (xSemaphoreTake(maxClientsMutex, portMAX_DELAY) == pdTRUE) {
     clients = this->maxClients;
     xSemaphoreGive(maxClientsMutex);
@@ -40,16 +40,16 @@ uint8_t RTSPServer::getMaxClients() {
   return clients;
 }
 
-void RTSPServer::incrementActiveRTSPClients() {
-  if (this->activeRTSPClients < 255) {
+void RTSPServerBase::incrementActiveRTSPClients() {
+  if (this->activeRTSPClients < MAX_CLIENTS) {
     this->activeRTSPClients++;
     RTSP_LOGI(LOG_TAG, "Active RTSP clients count incremented: %d", this->activeRTSPClients);
   } else {
-    RTSP_LOGW(LOG_TAG, "Max RTSP clients reached: %d", 255);
+    RTSP_LOGW(LOG_TAG, "Max RTSP clients reached: %d", MAX_CLIENTS);
   }
 }
 
-void RTSPServer::decrementActiveRTSPClients() {
+void RTSPServerBase::decrementActiveRTSPClients() {
   if (this->activeRTSPClients > 0) {
     this->activeRTSPClients--;
     RTSP_LOGI(LOG_TAG, "Active RTSP clients count decremented: %d", this->activeRTSPClients);
@@ -58,28 +58,123 @@ void RTSPServer::decrementActiveRTSPClients() {
   }
 }
 
-uint8_t RTSPServer::getActiveRTSPClients() {
+uint16_t RTSPServerBase::getActiveRTSPClients() {
   return this->activeRTSPClients;
 }
 
-void RTSPServer::updateIsPlayingStatus() {
-  bool anyClientStreaming = false;
-  for (const auto& sessionPair : sessions) {
-    if (sessionPair.second.isPlaying) {
-      anyClientStreaming = true;
-      break;
+// Uplink one unicast viewer of these tracks adds, from the measured rates
+uint32_t RTSPServerBase::viewerCostKbps(uint8_t trackMask, bool isTCP) const {
+  uint32_t kbps = 0;
+  for (uint8_t i = 0; i < this->trackCount; i++) {
+    if (trackMask & (1 << i)) {
+      kbps += this->trackRates[i].kbps();
     }
   }
-  setIsPlaying(anyClientStreaming);
+  return isTCP ? kbps * RTSP_TCP_COST_PERCENT / 100 : kbps;
 }
 
-void RTSPServer::setIsPlaying(bool playing) {
+/**
+ * @brief Uplink taken by every session that has set up tracks, playing or
+ * not. A multicast track costs the same however many sessions join it.
+ *
+ * @param multicastMask Set to the tracks already sent to the multicast group.
+ */
+uint32_t RTSPServerBase::committedKbps(uint8_t& multicastMask) {
+  uint32_t kbps = 0;
+  multicastMask = 0;
+  for (size_t i = 0, n = this->sessions.size(); i < n; i++) {
+    const RTSP_Session& session = this->sessions.at(i);
+    const RTSP_Sender& sender = this->sessions.sender(session);
+    if (!session.inUse || sender.trackMask == 0) {
+      continue;
+    }
+    if (sender.isMulticast) {
+      multicastMask |= sender.trackMask;
+    } else {
+      kbps += viewerCostKbps(sender.trackMask, sender.isTCP);
+    }
+  }
+  return kbps + viewerCostKbps(multicastMask, false);
+}
+
+/**
+ * @brief Decides whether the uplink budget has room for a session to take
+ * on more tracks with the given transport.
+ */
+bool RTSPServerBase::admitViewer(const RTSP_Session& session, uint8_t trackMask, bool isTCP, bool isMulticast) {
+  if (this->bandwidthBudgetKbps == 0) {
+    return true;
+  }
+  uint8_t multicastMask;
+  uint32_t committed = committedKbps(multicastMask);
+  // Tracks the session or the multicast group already carries cost nothing more
+  uint8_t added = trackMask & ~this->sessions.sender(session).trackMask;
+  if (isMulticast) {
+    added &= ~multicastMask;
+  }
+  uint32_t extra = viewerCostKbps(added, isTCP && !isMulticast);
+  if (committed + extra <= this->bandwidthBudgetKbps) {
+    return true;
+  }
+  RTSP_LOGW(LOG_TAG, "Session %u would need %lu kbit/s on top of %lu of a %lu kbit/s budget",
+            session.sessionID, static_cast<unsigned long>(extra), static_cast<unsigned long>(committed),
+            static_cast<unsigned long>(this->bandwidthBudgetKbps));
+  return false;
+}
+
+/**
+ * @brief Current estimate of the uplink taken by viewers, in kbit/s, as the
+ * RTSP task last computed it.
+ */
+uint32_t RTSPServerBase::getCommittedKbps() {
+  return this->committedKbpsEstimate.load();
+}
+
+// Runs on rtspTask, which owns the session pool
+void RTSPServerBase::refreshCommittedKbps() {
+  uint8_t multicastMask;
+  this->committedKbpsEstimate.store(committedKbps(multicastMask));
+  this->committedRefreshMs = millis();
+}
+
+void RTSPServerBase::updateIsPlayingStatus() {
+  setIsPlaying(this->sessions.anyPlaying());
+}
+
+void RTSPServerBase::publishSubscribers() {
+  SubscriberList& list = this->subscribers.beginUpdate();
+  bool multicastAdded = false;
+  const RTSP_Sender* senders = this->sessions.senderArray();
+  for (size_t i = 0, n = this->sessions.size(); i < n; i++) {
+    const RTSP_Sender& sender = senders[i];
+    if (!sender.isPlaying) {
+      continue;
+    }
+    if (sender.isMulticast) {
+      if (multicastAdded) {
+        // One multicast entry carries every track any multicast session set up
+        for (size_t j = 0; j < list.count; j++) {
+          if (list.entries[j].isMulticast) {
+            list.entries[j].trackMask |= sender.trackMask;
+            list.entries[j].awaitingFirstRtp |= sender.awaitingFirstRtp;
+          }
+        }
+        continue;
+      }
+      multicastAdded = true;
+    }
+    list.entries[list.count++] = sender;
+  }
+  this->subscribers.publish();
+}
+
+void RTSPServerBase::setIsPlaying(bool playing) {
     xSemaphoreTake(isPlayingMutex, portMAX_DELAY);
     this->isPlaying = playing;
     xSemaphoreGive(isPlayingMutex);
 }
 
-bool RTSPServer::getIsPlaying() const {
+bool RTSPServerBase::getIsPlaying() const {
     bool playing;
     xSemaphoreTake(isPlayingMutex, portMAX_DELAY);
     playing = this->isPlaying;
@@ -87,72 +182,185 @@ bool RTSPServer::getIsPlaying() const {
     return playing;
 }
 
-bool RTSPServer::readyToSendFrame() const {
+bool RTSPServerBase::readyToSendFrame() const {
   return getIsPlaying() && this->rtpFrameSent;
 }
 
-bool RTSPServer::readyToSendAudio() const {
+bool RTSPServerBase::readyToSendAudio() const {
   return getIsPlaying() && this->rtpAudioSent;
 }
 
-bool RTSPServer::readyToSendSubtitles() const {
+bool RTSPServerBase::readyToSendSubtitles() const {
   return getIsPlaying() && this->rtpSubtitlesSent;
 }
 
-int RTSPServer::captureCSeq(char* request) {
-  char* cseqStr = strstr(request, "CSeq: ");
-  if (cseqStr == NULL) {
-    return -1;
+size_t RTSPServerBase::getAudioRingLevel() const {
+  return this->audioRing != NULL ? this->audioRing->level() : 0;
+}
+
+uint32_t RTSPServerBase::getAudioOverruns() const {
+  return this->audioRing != NULL ? this->audioRing->overruns() : 0;
+}
+
+size_t RTSPServerBase::getClientProfileCount() {
+  size_t count = 0;
+  if (xSemaphoreTake(profilesMutex, portMAX_DELAY) == pdTRUE) {
+    count = this->clientProfiles.size();
+    xSemaphoreGive(profilesMutex);
   }
-  cseqStr += 6;
-  char* endOfLine = strchr(cseqStr, '\n');
-  if (endOfLine) {
-    *endOfLine = 0;
+  return count;
+}
+
+/**
+ * @brief Copies out one client profile: the quirks learned for a User-Agent
+ * and its accept-to-first-RTP times.
+ *
+ * @return false if index is out of range.
+ */
+bool RTSPServerBase::getClientProfile(size_t index, RTSP_ClientProfile& profile) {
+  bool found = false;
+  if (xSemaphoreTake(profilesMutex, portMAX_DELAY) == pdTRUE) {
+    const RTSP_ClientProfile* entry = this->clientProfiles.get(index);
+    if (entry != nullptr) {
+      profile = *entry;
+      found = true;
+    }
+    xSemaphoreGive(profilesMutex);
   }
-  int cseq = atoi(cseqStr);
-  if (endOfLine) {
-    *endOfLine = '\n';
+  return found;
+}
+
+/**
+ * @brief Tells the RTSP task that a track went out to a session waiting for
+ * its first packet. Called from the send path, which never touches the
+ * session pool itself.
+ */
+void RTSPServerBase::noteFirstRtp(uint8_t trackBit) {
+  if (this->firstRtpTracks.load() == 0) {
+    this->firstRtpMs.store(millis());
+  }
+  this->firstRtpTracks.fetch_or(trackBit);
+  this->eventLoop.wake();
+}
+
+/**
+ * @brief Records accept-to-first-RTP for the sessions the senders reported,
+ * on the RTSP task, and republishes them without the flag.
+ */
+void RTSPServerBase::collectFirstRtp() {
+  uint8_t tracks = this->firstRtpTracks.exchange(0);
+  if (tracks == 0) {
+    return;
   }
-  return cseq;
+  uint32_t sentMs = this->firstRtpMs.load();
+  bool recorded = false;
+  if (xSemaphoreTake(profilesMutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  for (size_t i = 0; i < this->sessions.size(); i++) {
+    RTSP_Session& session = this->sessions.at(i);
+    const RTSP_Sender& sender = this->sessions.sender(session);
+    if (session.inUse && sender.isPlaying && sender.awaitingFirstRtp && (sender.trackMask & tracks)) {
+      recordFirstRtp(session, sentMs);
+      recorded = true;
+    }
+  }
+  xSemaphoreGive(profilesMutex);
+  if (recorded) {
+    publishSubscribers();
+  }
+}
+
+/**
+ * @brief Records the time from accept to the session's first RTP packet in
+ * its client profile. The caller holds profilesMutex.
+ */
+void RTSPServerBase::recordFirstRtp(RTSP_Session& session, uint32_t now) {
+  this->sessions.sender(session).awaitingFirstRtp = false;
+  uint32_t elapsed = now - session.acceptTime;
+  this->clientProfiles.recordFirstRtp(session.profile, elapsed);
+  RTSP_LOGI(LOG_TAG, "Session %u: first RTP %lu ms after connect", session.sessionID, static_cast<unsigned long>(elapsed));
 }
 
-uint32_t RTSPServer::generateSessionID() {
+uint32_t RTSPServerBase::generateSessionID() {
   return esp_random();
 }
 
-uint32_t RTSPServer::extractSessionID(char* request) {
-  char* sessionStr = strstr(request, "Session: ");
-  if (sessionStr == NULL) {
-    return 0;
+const char* RTSPServerBase::dateHeader() {
+  // Only the RTSP task formats replies, so one cached line per second is enough
+  time_t now = time(NULL);
+  if (now != this->dateLineTime || this->dateLine[0] == '\0') {
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(this->dateLine, sizeof(this->dateLine), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &utc);
+    this->dateLineTime = now;
   }
-  sessionStr += 9;
-  char* endOfLine = strchr(sessionStr, '\n');
-  if (endOfLine) {
-    *endOfLine = 0;
+  return this->dateLine;
+}
+
+void RTSPServerBase::refreshDescribeCache(RTSP_Mount& mount) {
+  IPAddress localIp = WiFi.localIP();
+  uint32_t ip = static_cast<uint32_t>(localIp);
+  if (!mount.describeCacheDirty && ip == mount.describeCacheIp) {
+    return;
   }
 
-  while (isspace(*sessionStr)) sessionStr++;
-  char* end = sessionStr + strlen(sessionStr) - 1;
-  while (end > sessionStr && isspace(*end)) end--;
-  *(end + 1) = 0;
+  char ipString[16];
+  strncpy(ipString, localIp.toString().c_str(), sizeof(ipString) - 1);
+  ipString[sizeof(ipString) - 1] = '\0';
 
-  uint32_t sessionID = strtoul(sessionStr, NULL, 10);
+  this->sdpVersion++;
+  char sdp[512];
+  size_t sdpLen = LaxRTSPCompat::buildSdpDescription(*this, mount, ipString, sdp, sizeof(sdp));
 
-  if (endOfLine) {
-    *endOfLine = '\n';
+  int len = snprintf(mount.describeCache, sizeof(mount.describeCache),
+                     "Content-Base: rtsp://%s:%d%s/\r\n"
+                     "Content-Type: application/sdp\r\n"
+                     "Content-Length: %u\r\n\r\n"
+                     "%s",
+                     ipString, this->rtspPort, mount.path ? mount.path : "", static_cast<unsigned>(sdpLen), sdp);
+  if (len < 0) {
+    len = 0;
+  } else if (static_cast<size_t>(len) >= sizeof(mount.describeCache)) {
+    RTSP_LOGE(LOG_TAG, "Session description truncated");
+    len = sizeof(mount.describeCache) - 1;
   }
+  mount.describeCacheLen = static_cast<uint16_t>(len);
+  mount.describeCacheIp = ip;
+  mount.describeCacheDirty = false;
+  RTSP_LOGD(LOG_TAG, "Rebuilt session description for %s, version %u", mount.path ? mount.path : "/", this->sdpVersion);
+}
 
-  return sessionID;
+/**
+ * @brief Plays out backchannel audio received from clients.
+ *
+ * Call at the pace the speaker consumes, e.g. once per I2S DMA buffer: the
+ * jitter buffer plays out exactly count samples per call and fills gaps
+ * with concealment or silence, so the output never stalls.
+ *
+ * @return Samples that came from received audio, 0 while nobody talks.
+ */
+size_t RTSPServerBase::readBackchannelAudio(int16_t* samples, size_t count) {
+  if (this->backchannelTrack < 0 || xSemaphoreTake(backchannelMutex, portMAX_DELAY) != pdTRUE) {
+    memset(samples, 0, count * sizeof(int16_t));
+    return 0;
+  }
+  size_t real = this->backchannel->pull(samples, count);
+  xSemaphoreGive(backchannelMutex);
+  return real;
 }
 
-const char* RTSPServer::dateHeader() {
-  static char buffer[50];
-  time_t now = time(NULL);
-  strftime(buffer, sizeof(buffer), "Date: %a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
-  return buffer;
+// Loss, late packets, jitter and playout delay of the backchannel
+bool RTSPServerBase::getBackchannelStats(RTSP_BackchannelStats& stats) {
+  if (this->backchannelTrack < 0 || xSemaphoreTake(backchannelMutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  stats = this->backchannel->stats();
+  xSemaphoreGive(backchannelMutex);
+  return true;
 }
 
-bool RTSPServer::setCredentials(const char* username, const char* password) {
+bool RTSPServerBase::setCredentials(const char* username, const char* password) {
   if (username && password && strlen(username) > 0 && strlen(password) > 0) {
     char credentials[128];
     snprintf(credentials, sizeof(credentials), "%s:%s", username, password);
@@ -172,15 +380,3 @@ bool RTSPServer::setCredentials(const char* username, const char* password) {
     return false; // Indicate failure
   }
 }
-
-bool RTSPServer::decodeBase64(const char* input, size_t inputLen, char* output, size_t* outputLen) {
-    base64_decodestate state;
-    base64_init_decodestate(&state);
-    int len = base64_decode_block(input, inputLen, output, &state);
-    if (len >= 0) {
-        *outputLen = len;
-        output[len] = '\0';
-        return true;
-    }
-    return false;
-}
\ No newline at end of file
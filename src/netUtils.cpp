@@ -1,6 +1,6 @@
 #include "ESP32-RTSPServer.h"
 
-void RTSPServer::checkAndSetupUDP(int& rtpSocket, bool isMulticast, uint16_t rtpPort, IPAddress rtpIp) {
+void RTSPServerBase::checkAndSetupUDP(int& rtpSocket, bool isMulticast, uint16_t rtpPort, IPAddress rtpIp) {
   if (rtpSocket == -1) {
     rtpSocket = socket(AF_INET, SOCK_DGRAM, 0);
     if (rtpSocket < 0) {
@@ -29,41 +29,314 @@ void RTSPServer::checkAndSetupUDP(int& rtpSocket, bool isMulticast, uint16_t rtp
   }
 }
 
-void RTSPServer::sendTcpPacket(const uint8_t* packet, size_t packetSize, int sock) {
-  if (xSemaphoreTake(sendTcpMutex, portMAX_DELAY) == pdTRUE) {
-    ssize_t sent = 0;
-    while (sent < packetSize) {
-      ssize_t result = send(sock, packet + sent, packetSize - sent, 0);
-      if (result < 0) {
+// Waits up to timeoutMs for room in the socket's send buffer
+static bool waitWritable(int sock, uint32_t timeoutMs) {
+  fd_set write_fds;
+  FD_ZERO(&write_fds);
+  FD_SET(sock, &write_fds);
+  struct timeval tv = { .tv_sec = static_cast<time_t>(timeoutMs / 1000), .tv_usec = static_cast<suseconds_t>((timeoutMs % 1000) * 1000) };
+  return select(sock + 1, NULL, &write_fds, NULL, &tv) > 0;
+}
+
+/**
+ * @brief Sends one interleaved packet without ever blocking the control task.
+ *
+ * Queued replies go out first so a packet never lands inside one, then
+ * queued priority packets. A packet the socket only partly takes has its
+ * tail queued, keeping the `$` framing intact. A priority packet that can
+ * not go out at once is queued too, so audio never waits behind a video
+ * frame: it leaves before the frame's next fragment. Other packets are
+ * retried until RTSP_TCP_SEND_TIMEOUT_MS and then dropped. The wait happens
+ * outside the mutex so other connections, and audio, are not held up.
+ * Output queued on an idle connection wakes the control task, which sends
+ * it as soon as the socket takes it rather than with the next packet.
+ *
+ * @return false if the packet was dropped.
+ */
+bool RTSPServerBase::sendTcpPacket(const uint8_t* packet, size_t packetSize, const RTSP_Sender& target, bool priority) {
+  RTSP_Session& owner = this->sessions.at(target.outSlot);
+  uint32_t start = millis();
+  while (true) {
+    if (xSemaphoreTake(sendTcpMutex, portMAX_DELAY) != pdTRUE) {
+      RTSP_LOGE(LOG_TAG, "Failed to acquire mutex");
+      return false;
+    }
+    if (!flushOutput(owner) || (owner.outLen == 0 && !flushPriority(owner))) {
+      xSemaphoreGive(sendTcpMutex);
+      return false;
+    }
+    if (owner.outLen == 0 && owner.priorityLen == 0) {
+      ssize_t sent = send(owner.sock, packet, packetSize, 0);
+      if (sent < 0) {
         int err = errno;
-        if (err == EAGAIN || err == EWOULDBLOCK) {
-          fd_set write_fds;
-          FD_ZERO(&write_fds);
-          FD_SET(sock, &write_fds);
-          //struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 }; // 100ms
-          int ret = select(sock + 1, NULL, &write_fds, NULL, NULL);
-          if (ret <= 0) {
-            RTSP_LOGE(LOG_TAG, "Failed to send TCP packet, select timeout or error");
-            break;
+        if (err != EAGAIN && err != EWOULDBLOCK) {
+          if (err != EPIPE && err != ECONNRESET && err != ENOTCONN && err != EBADF) {
+            RTSP_LOGE(LOG_TAG, "Failed to send TCP packet, errno: %d", err);
           }
-          continue;
-        } else if (err != EPIPE && err != ECONNRESET && err != ENOTCONN && err != EBADF) {
-          RTSP_LOGE(LOG_TAG, "Failed to send TCP packet, errno: %d", err);
-          break;
-        } else {
-          break;
+          xSemaphoreGive(sendTcpMutex);
+          return false;
         }
-      } else {
-        sent += result;
+      } else if (sent > 0) {
+        bool queued = static_cast<size_t>(sent) == packetSize || queueOutput(owner, reinterpret_cast<const char*>(packet) + sent, packetSize - sent);
+        xSemaphoreGive(sendTcpMutex);
+        if (!queued) {
+          // Without the tail the `$` framing is lost; the control task closes the connection on the hangup
+          RTSP_LOGE(LOG_TAG, "TCP packet tail does not fit the output buffer, closing the connection");
+          shutdown(owner.sock, SHUT_RDWR);
+          return false;
+        }
+        if (static_cast<size_t>(sent) < packetSize) {
+          this->eventLoop.wake();
+        }
+        return true;
       }
     }
+    bool wasIdle = owner.outLen == 0 && owner.priorityLen == 0;
+    if (priority && queuePriority(owner, packet, packetSize)) {
+      xSemaphoreGive(sendTcpMutex);
+      if (wasIdle) {
+        this->eventLoop.wake();
+      }
+      return true;
+    }
+    xSemaphoreGive(sendTcpMutex);
+
+    uint32_t elapsed = millis() - start;
+    if (elapsed >= RTSP_TCP_SEND_TIMEOUT_MS || !waitWritable(owner.sock, RTSP_TCP_SEND_TIMEOUT_MS - elapsed)) {
+      RTSP_LOGD(LOG_TAG, "TCP client not keeping up, dropped a packet");
+      return false;
+    }
+  }
+}
+
+/**
+ * @brief Appends to a connection's output buffer. Call with sendTcpMutex held.
+ *
+ * @return false if the data does not fit; nothing is queued then.
+ */
+bool RTSPServerBase::queueOutput(RTSP_Session& owner, const char* data, size_t len) {
+  if (len > sizeof(owner.outBuf) - owner.outLen) {
+    return false;
+  }
+  memcpy(owner.outBuf + owner.outLen, data, len);
+  owner.outLen += len;
+  return true;
+}
+
+/**
+ * @brief Queues a whole packet to go out ahead of video. Call with
+ * sendTcpMutex held.
+ *
+ * @return false if it does not fit; nothing is queued then.
+ */
+bool RTSPServerBase::queuePriority(RTSP_Session& owner, const uint8_t* packet, size_t packetSize) {
+  if (owner.priorityBuf == NULL || packetSize > RTSP_PRIORITY_BUFFER_SIZE - owner.priorityLen) {
+    return false;
+  }
+  memcpy(owner.priorityBuf + owner.priorityLen, packet, packetSize);
+  owner.priorityLen += packetSize;
+  return true;
+}
+
+/**
+ * @brief Gives an interleaved connection its priority queue. Connections
+ * that only carry replies never need one, so it comes from the heap on the
+ * first TCP SETUP; without it audio waits like video does.
+ */
+void RTSPServerBase::allocatePriority(RTSP_Session& owner) {
+  if (owner.priorityBuf != NULL) {
+    return;
+  }
+  char* buffer = static_cast<char*>(malloc(RTSP_PRIORITY_BUFFER_SIZE));
+  if (buffer == NULL) {
+    RTSP_LOGW(LOG_TAG, "No memory for the audio queue of slot %u", owner.slot);
+    return;
+  }
+  if (xSemaphoreTake(sendTcpMutex, portMAX_DELAY) == pdTRUE) {
+    owner.priorityBuf = buffer;
+    owner.priorityLen = 0;
     xSemaphoreGive(sendTcpMutex);
   } else {
-    RTSP_LOGE(LOG_TAG, "Failed to acquire mutex");
+    free(buffer);
+  }
+}
+
+// Drops the priority queue of a closing connection
+void RTSPServerBase::freePriority(RTSP_Session& owner) {
+  if (owner.priorityBuf == NULL || xSemaphoreTake(sendTcpMutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  free(owner.priorityBuf);
+  owner.priorityBuf = NULL;
+  owner.priorityLen = 0;
+  xSemaphoreGive(sendTcpMutex);
+}
+
+/**
+ * @brief Sends queued priority packets while the socket takes them. Call
+ * with sendTcpMutex held and outBuf empty.
+ *
+ * The tail of a packet the socket only partly takes moves to outBuf, which
+ * stays the one place a partial packet waits in.
+ *
+ * @return false if the connection failed; its queued packets are discarded.
+ */
+bool RTSPServerBase::flushPriority(RTSP_Session& owner) {
+  static_assert(RTSP_PRIORITY_BUFFER_SIZE <= RTSP_OUTPUT_BUFFER_SIZE, "A priority packet's tail must fit the empty output buffer");
+  size_t done = 0;
+  while (done < owner.priorityLen) {
+    const char* packet = owner.priorityBuf + done;
+    size_t packetSize = RTSPPacket::kInterleavedHeaderSize + ((static_cast<uint8_t>(packet[2]) << 8) | static_cast<uint8_t>(packet[3]));
+    ssize_t sent = send(owner.sock, packet, packetSize, 0);
+    if (sent < 0) {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        break;
+      }
+      if (err != EPIPE && err != ECONNRESET && err != ENOTCONN && err != EBADF) {
+        RTSP_LOGE(LOG_TAG, "Failed to flush priority output, errno: %d", err);
+      }
+      owner.priorityLen = 0;
+      return false;
+    }
+    done += packetSize;
+    if (static_cast<size_t>(sent) < packetSize) {
+      queueOutput(owner, packet + sent, packetSize - sent);
+      break;
+    }
+  }
+  if (done > 0) {
+    memmove(owner.priorityBuf, owner.priorityBuf + done, owner.priorityLen - done);
+    owner.priorityLen -= done;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes as much queued output as the socket takes. Call with
+ * sendTcpMutex held.
+ *
+ * @return false if the connection failed; its queued output is discarded.
+ */
+bool RTSPServerBase::flushOutput(RTSP_Session& owner) {
+  size_t sent = 0;
+  while (sent < owner.outLen) {
+    ssize_t result = send(owner.sock, owner.outBuf + sent, owner.outLen - sent, 0);
+    if (result < 0) {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        break;
+      }
+      if (err != EPIPE && err != ECONNRESET && err != ENOTCONN && err != EBADF) {
+        RTSP_LOGE(LOG_TAG, "Failed to flush output, errno: %d", err);
+      }
+      owner.outLen = 0;
+      return false;
+    }
+    sent += result;
+  }
+  if (sent > 0) {
+    memmove(owner.outBuf, owner.outBuf + sent, owner.outLen - sent);
+    owner.outLen -= sent;
+  }
+  return true;
+}
+
+void RTSPServerBase::sendRtpDatagram(int rtpSocket, const uint8_t* packet, size_t packetSize, const RTSP_Sender& target, uint16_t sendRtpPort) {
+  struct sockaddr_in client_addr;
+  memset(&client_addr, 0, sizeof(client_addr));
+  client_addr.sin_family = AF_INET;
+  client_addr.sin_addr.s_addr = target.isMulticast ? this->rtpIpAddr : target.peerAddr;
+  client_addr.sin_port = htons(sendRtpPort);
+
+  sendto(rtpSocket, packet, packetSize, 0, (struct sockaddr*)&client_addr, sizeof(client_addr));
+}
+
+// Drains the backchannel's UDP socket
+void RTSPServerBase::readBackchannelSocket() {
+  int sock = this->tracks[this->backchannelTrack].unicastSocket;
+  uint8_t datagram[1500];
+  while (true) {
+    ssize_t len = recv(sock, datagram, sizeof(datagram), 0);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        RTSP_LOGW(LOG_TAG, "Backchannel receive failed, errno: %d", errno);
+      }
+      return;
+    }
+    receiveBackchannel(datagram, static_cast<size_t>(len));
+  }
+}
+
+// Takes a `$` frame from a client; RTP on its backchannel channel is played out
+void RTSPServerBase::receiveInterleaved(RTSP_Session& session, const uint8_t* frame, size_t len) {
+  if (this->backchannelTrack < 0 || len <= RTSPPacket::kInterleavedHeaderSize) {
+    return;
+  }
+  const RTSP_Sender& sender = this->sessions.sender(session);
+  if ((sender.trackMask & (1 << this->backchannelTrack)) && frame[1] == sender.channels[this->backchannelTrack]) {
+    receiveBackchannel(frame + RTSPPacket::kInterleavedHeaderSize, len - RTSPPacket::kInterleavedHeaderSize);
+  }
+}
+
+/**
+ * @brief Depacketizes one backchannel RTP packet into the jitter buffer.
+ *
+ * The buffer follows one sender by SSRC; another client takes over once
+ * the current one has been quiet for a second.
+ */
+void RTSPServerBase::receiveBackchannel(const uint8_t* rtp, size_t len) {
+  if (len < RTSPPacket::kRtpHeaderSize || (rtp[0] >> 6) != 2 || (rtp[1] & 0x7F) != this->backchannelFormat->payloadType) {
+    return;
+  }
+  size_t header = RTSPPacket::kRtpHeaderSize + 4 * (rtp[0] & 0x0F);
+  if (rtp[0] & 0x10) {
+    // A packet too short for the extension header it announces is malformed, not payload
+    if (len < header + 4) {
+      return;
+    }
+    header += 4 + 4 * ((rtp[header + 2] << 8) | rtp[header + 3]);
+  }
+  size_t padding = (rtp[0] & 0x20) ? rtp[len - 1] : 0;
+  if (len < header + padding) {
+    return;
+  }
+  const uint8_t* payload = rtp + header;
+  size_t payloadLen = len - header - padding;
+  uint16_t seq = (rtp[2] << 8) | rtp[3];
+  uint32_t timestamp = (static_cast<uint32_t>(rtp[4]) << 24) | (rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+  uint32_t ssrc = (static_cast<uint32_t>(rtp[8]) << 24) | (rtp[9] << 16) | (rtp[10] << 8) | rtp[11];
+
+  if (xSemaphoreTake(backchannelMutex, portMAX_DELAY) != pdTRUE) {
+    RTSP_LOGE(LOG_TAG, "Failed to acquire backchannel mutex");
+    return;
+  }
+  uint32_t now = millis();
+  if (ssrc != this->backchannelSsrc) {
+    if (this->backchannelSsrc != 0 && now - this->backchannelLastMs < kBackchannelTakeoverMs) {
+      xSemaphoreGive(backchannelMutex);
+      return;
+    }
+    this->backchannelSsrc = ssrc;
+    this->backchannel->reset();
+  }
+  this->backchannelLastMs = now;
+
+  const RTSP_PayloadInfo* format = this->backchannelFormat;
+  if (format == &RTSPL16Format::info) {
+    size_t count = RTSPL16Format::depacketizedSamples(payloadLen);
+    this->backchannel->push(seq, timestamp, now, count, [&](int16_t* out) { RTSPL16Format::depacketize(payload, count, out); });
+  } else if (format == &RTSPPcmuFormat::info) {
+    size_t count = RTSPPcmuFormat::depacketizedSamples(payloadLen);
+    this->backchannel->push(seq, timestamp, now, count, [&](int16_t* out) { RTSPPcmuFormat::depacketize(payload, count, out); });
+  } else {
+    size_t count = RTSPPcmaFormat::depacketizedSamples(payloadLen);
+    this->backchannel->push(seq, timestamp, now, count, [&](int16_t* out) { RTSPPcmaFormat::depacketize(payload, count, out); });
   }
+  xSemaphoreGive(backchannelMutex);
 }
 
-bool RTSPServer::setNonBlocking(int sock) { 
+bool RTSPServerBase::setNonBlocking(int sock) { 
   int flags = fcntl(sock, F_GETFL, 0); 
   if (flags == -1) { 
     RTSP_LOGE(LOG_TAG, "Failed to get socket flags"); 
@@ -2,7 +2,7 @@
 #include "LaxRTSPCompat.h"
 #include <cstring>
 
-void RTSPServer::wrapInHTTP(char* buffer, size_t len, char* response, size_t maxLen) {
+void RTSPServerBase::wrapInHTTP(const char* buffer, size_t len, char* response, size_t maxLen) {
     snprintf(response, maxLen,
              "HTTP/1.1 200 OK\r\n"
              "Content-Type: application/x-rtsp-tunnelled\r\n"
@@ -10,82 +10,136 @@ void RTSPServer::wrapInHTTP(char* buffer, size_t len, char* response, size_t max
              "Pragma: no-cache\r\n"
              "Cache-Control: no-cache\r\n"
              "\r\n"
-             "%s",
-             len, buffer);
+             "%.*s",
+             static_cast<int>(len), static_cast<int>(len), buffer);
+}
+
+/**
+ * @brief Queues a reply on the connection the session answers on and sends
+ * what the socket takes now; the rest goes out once it is writable.
+ *
+ * The whole reply is queued under sendTcpMutex, so interleaved media can
+ * never land inside it.
+ */
+void RTSPServerBase::sendResponse(RTSP_Session& session, const char* data, size_t len) {
+  RTSP_Session& owner = this->sessions.at(session.replySlot);
+  bool queued = false;
+  if (xSemaphoreTake(sendTcpMutex, portMAX_DELAY) == pdTRUE) {
+    queued = queueOutput(owner, data, len);
+    flushOutput(owner);
+    xSemaphoreGive(sendTcpMutex);
+  }
+  if (!queued) {
+    RTSP_LOGE(LOG_TAG, "Output buffer full, dropped response to session %u", session.sessionID);
+  }
+  watchClient(owner);
+}
+
+/**
+ * @brief Sends a reply that carries only a status line, CSeq and Date.
+ */
+void RTSPServerBase::sendStatus(RTSP_Session& session, const char* statusLine) {
+  RTSPResponse<128> response;
+  response.start(statusLine, session.cseq, dateHeader()).end();
+  sendResponse(session, response.data(), response.size());
+}
+
+/**
+ * @brief Answers a request the bandwidth budget has no room for: a redirect
+ * to the relay when one is set, 453 Not Enough Bandwidth otherwise.
+ */
+void RTSPServerBase::refuseForBandwidth(RTSP_Session& session) {
+  if (this->relayUrl == NULL || this->relayUrl[0] == '\0') {
+    sendStatus(session, RTSP_STATUS_NOT_ENOUGH_BANDWIDTH);
+    return;
+  }
+  RTSPResponse<384> response;
+  response.start(this->relayAsProxy ? RTSP_STATUS_USE_PROXY : RTSP_STATUS_MOVED_TEMPORARILY, session.cseq, dateHeader())
+          .append("Location: ").append(this->relayUrl).append("\r\n")
+          .end();
+  sendResponse(session, response.data(), response.size());
+  RTSP_LOGI(LOG_TAG, "Session %u sent to relay %s", session.sessionID, this->relayUrl);
+}
+
+/**
+ * @brief Answers the first request of a connection over the client limit
+ * with 503 Service Unavailable, in HTTP for a tunnel request. The caller
+ * closes the connection after it.
+ */
+void RTSPServerBase::refuseClient(const RTSP_Request& request, RTSP_Session& session) {
+  if (request.isHttp()) {
+    static const char kResponse[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+    sendResponse(session, kResponse, sizeof(kResponse) - 1);
+    return;
+  }
+  if (request.cseq == -1) {
+    sendResponse(session, RTSP_STATUS_SERVICE_UNAVAILABLE "\r\n", sizeof(RTSP_STATUS_SERVICE_UNAVAILABLE "\r\n") - 1);
+    return;
+  }
+  session.cseq = request.cseq;
+  sendStatus(session, RTSP_STATUS_SERVICE_UNAVAILABLE);
 }
 
 /**
  * @brief Handles the OPTIONS RTSP request.
  * 
- * @param request The RTSP request.
  * @param session The RTSP session.
  */
 
-void RTSPServer::handleOptions(char* request, RTSP_Session& session) {
-  char* urlStart = strstr(request, "rtsp://");
-  if (urlStart) {
-    char* pathStart = strchr(urlStart + 7, '/');
-    char* pathEnd = strchr(pathStart, ' ');
-    if (pathStart && pathEnd) {
-      *pathEnd = 0; // Null-terminate the path
-      // Path can be processed here if needed
-    }
-  }
-  
-  char response[512];
-  const char* publicMethods = "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN\r\n\r\n";
-  
-  snprintf(response, sizeof(response), 
-           "RTSP/1.0 200 OK\r\n"
-           "CSeq: %d\r\n"
-           "%s\r\n"
-           "%s",
-           session.cseq, 
-           dateHeader(), 
-           publicMethods);
+void RTSPServerBase::handleOptions(RTSP_Session& session) {
+  RTSPResponse<256> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader())
+          .append("Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN\r\n")
+          .end();
   
   if (session.isHttp) {
     char httpResponse[1024];
-    wrapInHTTP(response, strlen(response), httpResponse, sizeof(httpResponse));
-    write(session.httpSock, httpResponse, strlen(httpResponse));
+    wrapInHTTP(response.data(), response.size(), httpResponse, sizeof(httpResponse));
+    sendResponse(session, httpResponse, strlen(httpResponse));
   } else {
-    write(session.sock, response, strlen(response));
+    sendResponse(session, response.data(), response.size());
   }
 }
 
 /**
  * @brief Handles the DESCRIBE RTSP request.
  * 
+ * @param request The parsed DESCRIBE request; its URL picks the mount.
  * @param session The RTSP session.
  */
-void RTSPServer::handleDescribe(RTSP_Session& session) {
+void RTSPServerBase::handleDescribe(const RTSP_Request& request, RTSP_Session& session) {
   if (LaxRTSPSession::detectAndEnableLax(session.laxState, LaxRTSPSession::RequestType::Describe)) {
     RTSP_LOGW(LOG_TAG, "Session %u issued DESCRIBE out of order; switching to lax mode.", session.sessionID);
   }
 
-  char sdpDescription[512];
-  size_t sdpLen = LaxRTSPCompat::buildSdpDescription(*this, session, sdpDescription, sizeof(sdpDescription));
+  // Everything after the Date line is the mount's cached description
+  session.mount = findMount(request.url);
+  RTSP_Mount& mount = this->mounts[session.mount];
 
-  char response[1024];
-  int responseLen = snprintf(response, sizeof(response),
-                             "RTSP/1.0 200 OK\r\nCSeq: %d\r\n%s\r\nContent-Base: rtsp://%s:554/\r\nContent-Type: application/sdp\r\nContent-Length: %d\r\n\r\n"
-                             "%s",
-                             session.cseq, dateHeader(), WiFi.localIP().toString().c_str(), static_cast<int>(sdpLen), sdpDescription);
+  // Clients follow redirects most reliably here, so turn new viewers away
+  // early; without a transport yet, assume they will take unicast UDP
+  bool unicastBuilt = this->caps.udp || this->caps.tcp;
+  if (unicastBuilt && this->sessions.sender(session).trackMask == 0 && !admitViewer(session, mount.trackMask, false, false)) {
+    refuseForBandwidth(session);
+    return;
+  }
+
+  refreshDescribeCache(mount);
+  RTSPResponse<128 + RTSP_SDP_CACHE_SIZE> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader())
+          .append(mount.describeCache, mount.describeCacheLen);
   
-  write(session.isHttp ? session.httpSock : session.sock, response, responseLen);
-  session.hasFallbackSdp = true;
-  session.fallbackSdpLen = static_cast<uint16_t>(sdpLen);
-  memcpy(session.fallbackSdp, sdpDescription, sdpLen + 1);
+  sendResponse(session, response.data(), response.size());
   LaxRTSPSession::noteDescribe(session.laxState);
 }
 
 /**
  * @brief Handles the SETUP RTSP request.
  * 
- * @param request The RTSP request.
+ * @param request The parsed SETUP request.
  * @param session The RTSP session.
  */
-void RTSPServer::handleSetup(char* request, RTSP_Session& session) {
+void RTSPServerBase::handleSetup(const RTSP_Request& request, RTSP_Session& session) {
   bool transportAllowed = LaxRTSPSession::shouldAllowSetup(session.laxState);
   if (!transportAllowed) {
     bool violation = LaxRTSPSession::detectAndEnableLax(session.laxState, LaxRTSPSession::RequestType::Setup);
@@ -96,183 +150,134 @@ void RTSPServer::handleSetup(char* request, RTSP_Session& session) {
   }
 
   if (!transportAllowed) {
-    char response[256];
-    snprintf(response, sizeof(response),
-             "RTSP/1.0 455 Method Not Valid In This State\r\n"
-             "CSeq: %d\r\n"
-             "%s\r\n\r\n",
-             session.cseq, dateHeader());
-    write(session.isHttp ? session.httpSock : session.sock, response, strlen(response));
+    sendStatus(session, RTSP_STATUS_METHOD_NOT_VALID);
     return;
   }
 
+  session.mount = findMount(request.url);
   LaxRTSPCompat::ensureDescribe(*this, session, "SETUP without DESCRIBE");
 
-  session.isMulticast = strstr(request, "multicast") != NULL;
-  session.isTCP = strstr(request, "RTP/AVP/TCP") != NULL;
+  RTSP_Sender& sender = this->sessions.sender(session);
+  const RTSP_StringView& transportHeader = request.transport;
+  bool isMulticast = transportHeader.contains("multicast");
+  bool isTCP = transportHeader.contains("RTP/AVP/TCP");
 
-#ifndef OVERRIDE_RTSP_SINGLE_CLIENT_MODE
-  // Track the first client's connection type
-  if (!firstClientConnected) {
-    firstClientConnected = true;
-    firstClientIsMulticast = session.isMulticast;
-    firstClientIsTCP = session.isTCP;
+  // Refuse transports the media policy compiled out
+  bool transportBuilt = isTCP ? this->caps.tcp : (isMulticast ? this->caps.multicast : this->caps.udp);
+  if (!transportBuilt) {
+    RTSP_LOGW(LOG_TAG, "Rejecting SETUP for a transport this build does not support");
+    sendStatus(session, RTSP_STATUS_UNSUPPORTED_TRANSPORT);
+    return;
+  }
 
-    // Set max clients based on the first client's connection type, accounting for HTTP tunneling
-    if (session.isHttp) {
-        // Keep current max clients since it was already increased for HTTP tunneling
-        RTSP_LOGD(LOG_TAG, "Keeping current max clients for HTTP tunneling");
+  // SETUP is per track: the aggregate URL of a stream with several tracks
+  // gets 459, a mount without any track 404
+  uint8_t mountTracks = this->mounts[session.mount].trackMask;
+  int8_t trackIndex = findTrack(request.url, mountTracks);
+  if (trackIndex < 0) {
+    RTSP_LOGW(LOG_TAG, "SETUP URL names no track: %.*s", static_cast<int>(request.url.len), request.url.data);
+    sendStatus(session, mountTracks != 0 ? RTSP_STATUS_AGGREGATE_NOT_ALLOWED : RTSP_STATUS_NOT_FOUND);
+    return;
+  }
+
+  // Admit the viewer before touching its transport, so a refusal leaves the session as it was
+  if (!admitViewer(session, 1 << trackIndex, isTCP, isMulticast)) {
+    refuseForBandwidth(session);
+    return;
+  }
+
+  // Transport is per session; every receiver is fed from the same packets
+  sender.isMulticast = isMulticast;
+  sender.isTCP = isTCP;
+  sender.sock = session.isHttp ? session.httpSock : session.sock;
+  sender.outSlot = session.replySlot;
+  if (!isTCP && !isMulticast) {
+    // Resolve the unicast destination once here instead of per packet
+    struct sockaddr_in peerAddr;
+    socklen_t addrLen = sizeof(peerAddr);
+    if (getpeername(session.sock, (struct sockaddr*)&peerAddr, &addrLen) == 0) {
+      sender.peerAddr = peerAddr.sin_addr.s_addr;
     } else {
-        setMaxClients(firstClientIsMulticast ? this->maxRTSPClients : 1);
-    }
-  } else {
-    // Determine if the connection should be rejected
-    bool rejectConnection = (firstClientIsMulticast && !session.isMulticast) ||
-                            (!firstClientIsMulticast && (session.isMulticast || session.isTCP != firstClientIsTCP));
-
-    if (rejectConnection) {
-      RTSP_LOGW(LOG_TAG, "Rejecting connection because it does not match the first client's connection type");
-      char response[512];
-      snprintf(response, sizeof(response),
-               "RTSP/1.0 461 Unsupported Transport\r\n"
-               "CSeq: %d\r\n"
-               "%s\r\n\r\n",
-               session.cseq, dateHeader());
-      if (write(session.sock, response, strlen(response)) < 0) {
-        RTSP_LOGE(LOG_TAG, "Failed to send rejection response to client.");
-      }
-      return;
+      RTSP_LOGE(LOG_TAG, "Failed to get peer IP address");
     }
   }
-#else
-  setMaxClients(this->maxRTSPClients);
-#endif
-
-  bool setVideo = strstr(request, "video") != NULL;
-  bool setAudio = strstr(request, "audio") != NULL;
-  bool setSubtitles = strstr(request, "subtitles") != NULL;
   uint16_t clientPort = 0;
   uint16_t serverPort = 0;
-  uint8_t rtpChannel = 0;
+  uint8_t rtpChannel = static_cast<uint8_t>(trackIndex * 2);
 
   // Extract client port or RTP channel based on transport method
-  if (session.isTCP) {
-    char* interleaveStart = strstr(request, "interleaved=");
+  if (isTCP) {
+    const char* interleaveStart = transportHeader.find("interleaved=");
     if (interleaveStart) {
       interleaveStart += 12;
-      char* interleaveEnd = strchr(interleaveStart, '-');
-      if (interleaveStart && interleaveEnd) {
-        *interleaveEnd = 0;
-        rtpChannel = atoi(interleaveStart);
-        RTSP_LOGD(LOG_TAG, "Extracted RTP channel: %d", rtpChannel);
-      } else {
-        RTSP_LOGE(LOG_TAG, "Failed to find interleave end");
-      }
+      rtpChannel = RTSP_StringView{interleaveStart, static_cast<size_t>(transportHeader.data + transportHeader.len - interleaveStart)}.toUInt();
+      RTSP_LOGD(LOG_TAG, "Extracted RTP channel: %d", rtpChannel);
     } else {
-      RTSP_LOGE(LOG_TAG, "Failed to find interleaved=");
+      RTSP_LOGD(LOG_TAG, "No interleaved= given, using channel %d", rtpChannel);
     }
-  } else if (!session.isMulticast) {
-    char* rtpPortStart = strstr(request, "client_port=");
+  } else if (!isMulticast) {
+    const char* rtpPortStart = transportHeader.find("client_port=");
     if (rtpPortStart) {
       rtpPortStart += 12;
-      char* rtpPortEnd = strchr(rtpPortStart, '-');
-      if (rtpPortStart && rtpPortEnd) {
-        *rtpPortEnd = 0;
-        clientPort = atoi(rtpPortStart);
-        RTSP_LOGD(LOG_TAG, "Extracted client port: %d", clientPort);
-      } else {
-        RTSP_LOGE(LOG_TAG, "Failed to find client port end");
-      }
+      clientPort = RTSP_StringView{rtpPortStart, static_cast<size_t>(transportHeader.data + transportHeader.len - rtpPortStart)}.toUInt();
+      RTSP_LOGD(LOG_TAG, "Extracted client port: %d", clientPort);
     } else {
       RTSP_LOGE(LOG_TAG, "Failed to find client_port=");
     }
   }
 
-  // Setup video, audio, or subtitles based on the request
-  if (setVideo) {
-    session.cVideoPort = clientPort;
-    serverPort = this->rtpVideoPort;
-    this->videoCh = rtpChannel;
-    if (!session.isTCP) {
-      if (session.isMulticast) {
-        this->checkAndSetupUDP(this->videoMulticastSocket, true, serverPort, this->rtpIp);
-      } else {
-        this->checkAndSetupUDP(this->videoUnicastSocket, false, serverPort, this->rtpIp);
-      }
-    }
-  }
-  
-  if (setAudio) {
-    session.cAudioPort = clientPort;
-    serverPort = this->rtpAudioPort;
-    this->audioCh = rtpChannel;
-    if (!session.isTCP) {
-      if (session.isMulticast) {
-        this->checkAndSetupUDP(this->audioMulticastSocket, true, serverPort, this->rtpIp);
-      } else {
-        this->checkAndSetupUDP(this->audioUnicastSocket, false, serverPort, this->rtpIp);
-      }
-    }
-  }
-  
-  if (setSubtitles) {
-    session.cSrtPort = clientPort;
-    serverPort = this->rtpSubtitlesPort;
-    this->subtitlesCh = rtpChannel;
-    if (!session.isTCP) {
-      if (session.isMulticast) {
-        this->checkAndSetupUDP(this->subtitlesMulticastSocket, true, serverPort, this->rtpIp);
-      } else {
-        this->checkAndSetupUDP(this->subtitlesUnicastSocket, false, serverPort, this->rtpIp);
+  // Setup the track named in the request
+  RTSP_Track& track = this->tracks[trackIndex];
+  sender.trackMask |= 1 << trackIndex;
+  sender.clientPorts[trackIndex] = clientPort;
+  serverPort = track.serverPort;
+  sender.channels[trackIndex] = rtpChannel;
+  if (isTCP) {
+    allocatePriority(this->sessions.at(sender.outSlot));
+  } else {
+    if (isMulticast) {
+      this->checkAndSetupUDP(track.multicastSocket, true, serverPort, this->rtpIp);
+    } else {
+      bool fresh = track.unicastSocket == -1;
+      this->checkAndSetupUDP(track.unicastSocket, false, serverPort, this->rtpIp);
+      if (fresh && trackIndex == this->backchannelTrack && track.unicastSocket != -1) {
+        // Clients send on this one; the RTSP task reads it
+        this->eventLoop.add(track.unicastSocket, RTSPServerEventLoop::kMedia);
       }
     }
   }
 
-
-#ifdef RTSP_VIDEO_NONBLOCK
-  if (setVideo && this->rtpVideoTaskHandle == NULL) {
-    xTaskCreate(rtpVideoTaskWrapper, "rtpVideoTask", RTP_STACK_SIZE, this, RTP_PRI, &this->rtpVideoTaskHandle);
-  }
-  if (this->rtspStreamBuffer == NULL && psramFound()) {
-    this->rtspStreamBuffer = (uint8_t*)ps_malloc(MAX_RTSP_BUFFER);
-  }
-#endif
-
-  char* response = (char*)malloc(512);
-  if (response == NULL) {
-    RTSP_LOGE(LOG_TAG, "Failed to allocate memory");
-    return;
-  }
+  // Any audio the server sends, main stream or variant, needs the audio task; the backchannel is only received
+  bool sendsAudio = trackIndex != this->backchannelTrack && strcmp(track.format->media, "audio") == 0;
+  startMediaTasks(track.format == &RTSPJpegFormat::info, sendsAudio);
 
   // Formulate the response based on transport method
-  if (session.isTCP) {
-    snprintf(response, 512,
-             "RTSP/1.0 200 OK\r\n"
-             "CSeq: %d\r\n"
-             "%s\r\n"
-             "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n"
-             "Session: %lu\r\n\r\n",
-             session.cseq, dateHeader(), rtpChannel, rtpChannel + 1, session.sessionID);
-  } else if (session.isMulticast) {
-    snprintf(response, 512,
-             "RTSP/1.0 200 OK\r\nCSeq: %d\r\n%s\r\nTransport: RTP/AVP;multicast;destination=%s;port=%d-%d;ttl=%d\r\nSession: %lu\r\n\r\n",
-             session.cseq, dateHeader(), this->rtpIp.toString().c_str(), serverPort, serverPort + 1, this->rtpTTL, session.sessionID);
+  RTSPResponse<384> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader());
+  if (isTCP) {
+    response.append("Transport: RTP/AVP/TCP;unicast;interleaved=")
+            .appendUInt(rtpChannel).append("-").appendUInt(rtpChannel + 1).append("\r\n");
+  } else if (isMulticast) {
+    response.append("Transport: RTP/AVP;multicast;destination=").append(this->rtpIpString)
+            .append(";port=").appendUInt(serverPort).append("-").appendUInt(serverPort + 1)
+            .append(";ttl=").appendUInt(this->rtpTTL).append("\r\n");
   } else {
-    snprintf(response, 512,
-             "RTSP/1.0 200 OK\r\nCSeq: %d\r\n%s\r\nTransport: RTP/AVP;unicast;destination=127.0.0.1;source=127.0.0.1;client_port=%d-%d;server_port=%d-%d\r\nSession: %lu\r\n\r\n",
-             session.cseq, dateHeader(), clientPort, clientPort + 1, serverPort, serverPort + 1, session.sessionID);
+    response.append("Transport: RTP/AVP;unicast;destination=127.0.0.1;source=127.0.0.1;client_port=")
+            .appendUInt(clientPort).append("-").appendUInt(clientPort + 1)
+            .append(";server_port=").appendUInt(serverPort).append("-").appendUInt(serverPort + 1).append("\r\n");
   }
+  response.session(session.sessionID).end();
 
-  write(session.isHttp ? session.httpSock : session.sock, response, strlen(response));
+  sendResponse(session, response.data(), response.size());
   
-  free(response);
   LaxRTSPSession::noteSetup(session.laxState);
   bool resumed = LaxRTSPCompat::resumeDeferredPlay(session);
   if (resumed) {
-    setIsPlaying(true);
-    RTSP_LOGW(LOG_TAG, "Session %u had deferred PLAY; starting now.", session.sessionID);
+    RTSP_LOGD(LOG_TAG, "Session %u had deferred PLAY; starting now.", session.sessionID);
+    startPlaying(session);
+  } else {
+    publishSubscribers();
   }
-  this->sessions[session.sessionID] = session;
 }
 
 /**
@@ -280,7 +285,7 @@ void RTSPServer::handleSetup(char* request, RTSP_Session& session) {
  * 
  * @param session The RTSP session.
  */
-void RTSPServer::handlePlay(RTSP_Session& session) {
+void RTSPServerBase::handlePlay(RTSP_Session& session) {
   bool allowPlay = LaxRTSPSession::shouldAllowPlay(session.laxState);
   if (!allowPlay) {
     bool violation = LaxRTSPSession::detectAndEnableLax(session.laxState, LaxRTSPSession::RequestType::Play);
@@ -291,42 +296,57 @@ void RTSPServer::handlePlay(RTSP_Session& session) {
   }
 
   if (!allowPlay) {
-    char response[256];
-    snprintf(response, sizeof(response),
-             "RTSP/1.0 455 Method Not Valid In This State\r\n"
-             "CSeq: %d\r\n"
-             "%s\r\n\r\n",
-             session.cseq,
-             dateHeader());
-    write(session.isHttp ? session.httpSock : session.sock, response, strlen(response));
+    sendStatus(session, RTSP_STATUS_METHOD_NOT_VALID);
     return;
   }
 
   LaxRTSPCompat::ensureDescribe(*this, session, "PLAY without DESCRIBE");
 
-  if (!session.laxState.didSetup) {
+  bool deferred = !session.laxState.didSetup;
+  if (deferred) {
     LaxRTSPSession::flagDeferredPlay(session.laxState);
-    RTSP_LOGW(LOG_TAG, "Session %u PLAY accepted but deferred until SETUP completes.", session.sessionID);
-  } else {
-    session.isPlaying = true;
-    setIsPlaying(true);
-  }
-
-  char response[256];
-  snprintf(response, sizeof(response),
-           "RTSP/1.0 200 OK\r\n"
-           "CSeq: %d\r\n"
-           "%s\r\n"
-           "Range: npt=0.000-\r\n"
-           "Session: %lu\r\n"
-           "RTP-Info: url=rtsp://127.0.0.1:554/\r\n\r\n",
-           session.cseq,
-           dateHeader(),
-           session.sessionID);
-
-  write(session.isHttp ? session.httpSock : session.sock, response, strlen(response));
+    RTSP_LOGD(LOG_TAG, "Session %u PLAY accepted but deferred until SETUP completes.", session.sessionID);
+  }
+
+  RTSPResponse<256> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader())
+          .append("Range: npt=0.000-\r\n")
+          .session(session.sessionID)
+          .append("RTP-Info: url=rtsp://127.0.0.1:554/\r\n")
+          .end();
+
+  sendResponse(session, response.data(), response.size());
   LaxRTSPSession::notePlay(session.laxState);
-  this->sessions[session.sessionID] = session;
+
+  // Media only after the reply, so the client knows the session is playing
+  if (!deferred) {
+    startPlaying(session);
+  }
+}
+
+/**
+ * @brief Starts media for a session whose PLAY went through, beginning with
+ * the last video frame so the client has a picture before the next capture.
+ * 
+ * @param session The RTSP session.
+ */
+void RTSPServerBase::startPlaying(RTSP_Session& session) {
+  RTSP_Sender& sender = this->sessions.sender(session);
+  // Sent before the session is published, so it cannot interleave with live packets. After
+  // PAUSE the client has seen the cached frame's packets already, so only the first PLAY replays.
+  bool replayed = !session.hasPlayed && sendCachedFrame(sender);
+  session.hasPlayed = true;
+  if (replayed) {
+    if (xSemaphoreTake(profilesMutex, portMAX_DELAY) == pdTRUE) {
+      recordFirstRtp(session, millis());
+      xSemaphoreGive(profilesMutex);
+    }
+  } else {
+    sender.awaitingFirstRtp = true;
+  }
+  sender.isPlaying = true;
+  publishSubscribers();
+  setIsPlaying(true);
 }
 
 /**
@@ -334,16 +354,14 @@ void RTSPServer::handlePlay(RTSP_Session& session) {
  * 
  * @param session The RTSP session.
  */
-void RTSPServer::handlePause(RTSP_Session& session) {
-  session.isPlaying = false;
-  this->sessions[session.sessionID] = session;
+void RTSPServerBase::handlePause(RTSP_Session& session) {
+  this->sessions.sender(session).isPlaying = false;
+  publishSubscribers();
   updateIsPlayingStatus();
-  char response[128];
-  int len = snprintf(response, sizeof(response),
-                     "RTSP/1.0 200 OK\r\nCSeq: %d\r\nSession: %lu\r\n\r\n",
-                     session.cseq, session.sessionID);
+  RTSPResponse<128> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader()).session(session.sessionID).end();
   
-  write(session.isHttp ? session.httpSock : session.sock, response, len);
+  sendResponse(session, response.data(), response.size());
   RTSP_LOGD(LOG_TAG, "Session %u is now paused.", session.sessionID);
 }
 
@@ -352,64 +370,50 @@ void RTSPServer::handlePause(RTSP_Session& session) {
  * 
  * @param session The RTSP session.
  */
-void RTSPServer::handleTeardown(RTSP_Session& session) {
-  session.isPlaying = false;
-  this->sessions[session.sessionID] = session;
+void RTSPServerBase::handleTeardown(RTSP_Session& session) {
+  this->sessions.sender(session).isPlaying = false;
+  this->sessions.sender(session).trackMask = 0; // Frees its share of the bandwidth budget
+  publishSubscribers();
   updateIsPlayingStatus();
 
-  char response[128];
-  int len = snprintf(response, sizeof(response),
-                     "RTSP/1.0 200 OK\r\nCSeq: %d\r\nSession: %lu\r\n\r\n",
-                     session.cseq, session.sessionID);
+  RTSPResponse<128> response;
+  response.start(RTSP_STATUS_OK, session.cseq, dateHeader()).session(session.sessionID).end();
   
-  write(session.isHttp ? session.httpSock : session.sock, response, len);
+  sendResponse(session, response.data(), response.size());
 
   RTSP_LOGD(LOG_TAG, "RTSP Session %u has been torn down.", session.sessionID);
 }
 
 /**
- * @brief Handles incoming RTSP requests.
+ * @brief Reads what the client sent into the connection's input buffer and
+ * serves every complete message in it.
  * 
- * @param sock The socket file descriptor.
- * @param clientAddr The client address.
- * @return true if the request was handled successfully, false otherwise.
+ * @param session The RTSP session.
+ * @return true to keep the connection open, false to close it.
  */
-bool RTSPServer::handleRTSPRequest(RTSP_Session& session) {
-  char *buffer = (char *)ps_malloc(RTSP_BUFFER_SIZE);
-  if (!buffer) {
-    RTSP_LOGE(LOG_TAG, "Failed to allocate buffer with ps_malloc");
+bool RTSPServerBase::handleRTSPRequest(RTSP_Session& session) {
+  char* input = session.inBuf + session.inLen;
+  size_t space = sizeof(session.inBuf) - session.inLen;
+  // Base64 is read in just ahead of where it decodes to
+  size_t gap = session.base64Input ? RTSPBase64Decoder::kInPlaceGap : 0;
+  if (space <= gap) {
+    RTSP_LOGE(LOG_TAG, "Request too large for buffer. Total length: %u", session.inLen);
     return false;
   }
 
-  int totalLen = 0;
-  int len = 0;
-
-  // Read data from socket until end of RTSP header or buffer limit is reached
-  while ((len = recv(session.sock, buffer + totalLen, RTSP_BUFFER_SIZE - totalLen - 1, 0)) > 0) {
-    totalLen += len;
-    if (strstr(buffer, "\r\n\r\n")) {
-      break;
-    }
-    if (totalLen >= RTSP_BUFFER_SIZE) { // Adjusted for null-terminator
-      RTSP_LOGE(LOG_TAG, "Request too large for buffer. Total length: %d", totalLen);
-      free(buffer); // Free allocated memory
-      return false;
-    }
-  }
-
-  if (totalLen <= 0) {
+  int len = recv(session.sock, input + gap, space - gap, 0);
+  if (len <= 0) {
     int err = errno;
-    free(buffer);
-    if (err == EWOULDBLOCK || err == EAGAIN) {
+    if (len < 0 && (err == EWOULDBLOCK || err == EAGAIN)) {
       return true;
-    } else if (err == ECONNRESET || err == ENOTCONN) {
+    } else if (len == 0 || err == ECONNRESET || err == ENOTCONN) {
       RTSP_LOGD(LOG_TAG, "Connection reset/closed - HandleTeardown");
       // Handle teardown for current session
       this->handleTeardown(session);
       // If this is an HTTP session, find and teardown both GET and POST sessions
       if (session.isHttp && session.sessionCookie[0] != '\0') {
           // Find the paired session
-          RTSP_Session* pairedSession = findSessionByCookie(session.sessionCookie);
+          RTSP_Session* pairedSession = this->sessions.findByCookie(session.sessionCookie);
           if (pairedSession && pairedSession != &session) {
               RTSP_LOGD(LOG_TAG, "Found paired HTTP session, handling teardown");
               this->handleTeardown(*pairedSession);
@@ -423,137 +427,177 @@ bool RTSPServer::handleRTSPRequest(RTSP_Session& session) {
     }
   }
 
-  // Check to see if RTCP packet and ignore for now...
-  buffer[totalLen] = 0; // Null-terminate the buffer
-  if (buffer[0] == '$') {
-    free(buffer); // Free allocated memory
-    return true; 
+  // Tunnelled RTSP arrives base64 encoded on the POST connection. It is
+  // decoded as it arrives; a quantum split across reads carries over.
+  if (session.base64Input) {
+    len = session.base64.decode(input + gap, len, input);
+    if (len < 0) {
+      RTSP_LOGE(LOG_TAG, "Invalid base64 on tunnel session %u", session.sessionID);
+      return false;
+    }
   }
+  session.inLen += len;
+  return processInput(session);
+}
 
-  uint8_t firstByte = buffer[0]; 
-  uint8_t version = (firstByte >> 6) & 0x03;
-  if (version == 2) { 
-    uint8_t payloadType = buffer[1] & 0x7F;
-    if (payloadType >= 200 && payloadType <= 204) {
-      free(buffer); // Free allocated memory
-      return true;
-    }
-    free(buffer); // Free allocated memory
+/**
+ * @brief Serves every complete message buffered for the session.
+ *
+ * The buffer may hold several pipelined requests and interleaved frames back
+ * to back. Parsing pauses while the reply connection has more than half its
+ * output buffer queued and resumes once it drains, so a client that does not
+ * read cannot make the server queue replies without bound.
+ *
+ * @return true to keep the connection open, false to close it.
+ */
+bool RTSPServerBase::processInput(RTSP_Session& session) {
+  if (session.inputPaused) {
     return true;
   }
-
-  // Check if the request is base64 encoded FIRST
-  RTSP_LOGD(LOG_TAG, "Checking if base64 encoded");
-  
-  if (isBase64Encoded(buffer, totalLen)) {
-    RTSP_LOGD(LOG_TAG, "Buffer is base64 encoded, decoding...");
-    char* decodedBuffer = (char*)malloc(RTSP_BUFFER_SIZE);
-    if (!decodedBuffer) {
-      RTSP_LOGE(LOG_TAG, "Failed to allocate memory for decoded buffer");
-      free(buffer);
-      return false;
+  RTSP_Session& owner = this->sessions.at(session.replySlot);
+  size_t offset = 0;
+  while (offset < session.inLen) {
+    RTSP_Request request;
+    size_t consumed = 0;
+    size_t scanned = session.inScanned;
+    RTSPRequestParser::Status status = RTSPRequestParser::parse(session.inBuf + offset, session.inLen - offset, scanned, request, consumed);
+    session.inScanned = static_cast<uint16_t>(scanned);
+
+    if (status == RTSPRequestParser::NeedMore) {
+      break;
     }
-
-    size_t decodedLen;
-    if (decodeBase64(buffer, totalLen, decodedBuffer, &decodedLen)) {
-      RTSP_LOGD(LOG_TAG, "Decoded buffer: %s", decodedBuffer);
-      free(buffer);
-      buffer = decodedBuffer;
-      totalLen = decodedLen;
-    } else {
-      RTSP_LOGE(LOG_TAG, "Failed to decode base64 buffer");
-      free(decodedBuffer);
-      free(buffer);
-      return false;
+    if (status == RTSPRequestParser::Invalid) {
+      RTSP_LOGW(LOG_TAG, "Dropping %u bytes of unparseable input", static_cast<unsigned>(session.inLen - offset));
+      offset = session.inLen;
+      session.inScanned = 0;
+      break;
+    }
+    if (status == RTSPRequestParser::Request) {
+      if (session.refused) {
+        refuseClient(request, session);
+        return false;
+      }
+      if (owner.outLen > sizeof(owner.outBuf) / 2) {
+        // Leave the request buffered until the client reads what is queued
+        session.inputPaused = true;
+        owner.inputWaiting = true;
+        watchClient(session);
+        watchClient(owner);
+        break;
+      }
+      bool wasBase64 = session.base64Input;
+      handleParsedRequest(request, session);
+      if (session.base64Input && !wasBase64) {
+        // Whatever followed the POST headers is the start of the base64 stream
+        char* tail = session.inBuf + offset + consumed;
+        int tailLen = session.base64.decode(tail, session.inLen - offset - consumed, tail);
+        if (tailLen < 0) {
+          RTSP_LOGE(LOG_TAG, "Invalid base64 on tunnel session %u", session.sessionID);
+          return false;
+        }
+        session.inLen = static_cast<uint16_t>(offset + consumed + tailLen);
+      }
+    }
+    if (status == RTSPRequestParser::Interleaved) {
+      // Backchannel RTP; anything else (RTCP receiver reports) is consumed and ignored
+      receiveInterleaved(session, reinterpret_cast<const uint8_t*>(session.inBuf + offset), consumed);
     }
+    offset += consumed;
   }
 
-  int cseq = captureCSeq(buffer);
-  if (cseq == -1) {
-    RTSP_LOGE(LOG_TAG, "CSeq not found in request: %s", buffer);
-    write(session.sock, "RTSP/1.0 400 Bad Request\r\n\r\n", 29);
-    free(buffer); // Free allocated memory
-    return true;
+  if (offset > 0) {
+    memmove(session.inBuf, session.inBuf + offset, session.inLen - offset);
+    session.inLen -= offset;
   }
+  return true;
+}
 
-  session.cseq = cseq;
+/**
+ * @brief Handles one parsed request.
+ * 
+ * @param request The parsed request, viewing the session's input buffer.
+ * @param session The RTSP session the request arrived on.
+ */
+void RTSPServerBase::handleParsedRequest(const RTSP_Request& request, RTSP_Session& session) {
+  bool isHttpRequest = request.isHttp();
+  if (!isHttpRequest && request.cseq == -1) {
+    RTSP_LOGE(LOG_TAG, "CSeq not found in request: %.*s", static_cast<int>(request.method.len), request.method.data);
+    sendResponse(session, RTSP_STATUS_BAD_REQUEST "\r\n", sizeof(RTSP_STATUS_BAD_REQUEST "\r\n") - 1);
+    return;
+  }
 
-  // Extract session ID using the provided function
-  uint32_t sessionID = extractSessionID(buffer);
-  if (sessionID != 0 && sessions.find(sessionID) != sessions.end()) {
-    session.sessionID = sessionID;
+  session.cseq = request.cseq;
+
+  // A tunnelled client may carry on a session over a fresh POST connection;
+  // commands then act on the session that owns the ID, which replies over
+  // the same GET socket.
+  RTSP_Session* target = &session;
+  if (request.sessionID != 0 && request.sessionID != session.sessionID) {
+    RTSP_Session* owner = this->sessions.find(request.sessionID);
+    if (owner && owner->isHttp && session.isHttp) {
+      owner->cseq = request.cseq;
+      target = owner;
+    }
   }
 
+  // Known clients start on the lax path they are going to need
+  LaxRTSPCompat::matchProfile(*this, *target, request.userAgent);
+
   // Authentication check
   if (authEnabled) {
-    char* authHeader = strstr(buffer, "Authorization: Basic ");
-    if (!authHeader) {
+    const RTSP_StringView& auth = request.authorization;
+    if (!auth.startsWith("Basic ") || !RTSP_StringView{auth.data + 6, auth.len - 6}.equals(base64Credentials)) {
       sendUnauthorizedResponse(session);
-      free(buffer); // Free allocated memory
-      return true;
-    } else {
-      authHeader += 21; // Move pointer to the base64 encoded credentials
-      char* authEnd = strstr(authHeader, "\r\n");
-      if (authEnd) {
-        *authEnd = 0; // Null-terminate the base64 string
-        if (strcmp(authHeader, base64Credentials) != 0) {
-          sendUnauthorizedResponse(session);
-          free(buffer); // Free allocated memory
-          return true;
-        } else {
-          // Remove the Authorization header from the buffer before continuing
-          memmove(authHeader - 21, authEnd + 2, strlen(authEnd + 2) + 1);
-        }
-      } else {
-        sendUnauthorizedResponse(session);
-        free(buffer); // Free allocated memory
-        return true;
-      }
+      return;
     }
   }
 
   // Handle HTTP tunneling methods first
-  if (strncmp(buffer, "GET / HTTP/", 10) == 0 && strstr(buffer, "Accept: application/x-rtsp-tunnelled")) {
-    RTSP_LOGD(LOG_TAG, "Handle GET HTTP Request: %s", buffer);
+  if (this->caps.httpTunnel && isHttpRequest && request.method.equals("GET") && request.accept.contains("application/x-rtsp-tunnelled")) {
+    RTSP_LOGD(LOG_TAG, "Handle GET HTTP Request: %.*s", static_cast<int>(request.url.len), request.url.data);
     
     // Increase max clients by 1 to account for HTTP tunneling
-    uint8_t currentMaxClients = getMaxClients();
+    uint16_t currentMaxClients = getMaxClients();
     setMaxClients(currentMaxClients + 1);
     RTSP_LOGD(LOG_TAG, "Increased max clients to %d for HTTP tunneling", currentMaxClients + 1);
     
     session.isHttp = true;
-    char sessionCookie[MAX_COOKIE_LENGTH];
-    extractSessionCookie(buffer, sessionCookie, sizeof(sessionCookie));
-    strncpy(session.sessionCookie, sessionCookie, MAX_COOKIE_LENGTH - 1);
-    session.sessionCookie[MAX_COOKIE_LENGTH - 1] = '\0';
-
-    char response[512];
-    snprintf(response, sizeof(response),
-             "HTTP/1.1 200 OK\r\n"  // Use HTTP/1.1 for better compatibility
-             "Server: ESP32\r\n"
-             "Connection: keep-alive\r\n"
-             "%s"
-             "Cache-Control: no-store\r\n"
-             "Pragma: no-cache\r\n"
-             "Content-Type: application/x-rtsp-tunnelled\r\n"
-             "\r\n",
-             dateHeader());
-    write(session.sock, response, strlen(response));  // Use direct socket for initial HTTP response
+    request.sessionCookie.copyTo(session.sessionCookie, sizeof(session.sessionCookie));
+    this->sessions.indexCookie(session);
+
+    RTSPResponse<256> response;
+    response.append("HTTP/1.1 200 OK\r\n"  // Use HTTP/1.1 for better compatibility
+                    "Server: ESP32\r\n"
+                    "Connection: keep-alive\r\n")
+            .append(dateHeader())
+            .append("Cache-Control: no-store\r\n"
+                    "Pragma: no-cache\r\n"
+                    "Content-Type: application/x-rtsp-tunnelled\r\n")
+            .end();
+    sendResponse(session, response.data(), response.size());  // Goes out on the GET socket itself
   }
-  else if (strncmp(buffer, "POST / HTTP/", 11) == 0 && strstr(buffer, "Content-Type: application/x-rtsp-tunnelled")) {
+  else if (this->caps.httpTunnel && isHttpRequest && request.method.equals("POST") && request.contentType.contains("application/x-rtsp-tunnelled")) {
     RTSP_LOGD(LOG_TAG, "RTSP-over-HTTP Tunnel Established");
-    RTSP_LOGD(LOG_TAG, "Handle POST HTTP Request: %s", buffer);
+    RTSP_LOGD(LOG_TAG, "Handle POST HTTP Request: %.*s", static_cast<int>(request.url.len), request.url.data);
+
+    // The rest of this connection is base64 encoded RTSP
+    session.base64Input = true;
+    session.base64.reset();
     
     // Extract cookie from POST request
     char sessionCookie[MAX_COOKIE_LENGTH];
-    extractSessionCookie(buffer, sessionCookie, sizeof(sessionCookie));
+    request.sessionCookie.copyTo(sessionCookie, sizeof(sessionCookie));
     
     // Find corresponding GET session
-    RTSP_Session* getSession = findSessionByCookie(sessionCookie);
+    RTSP_Session* getSession = this->sessions.findByCookie(sessionCookie);
     if (getSession) {
         // Keep POST session but use GET session's socket for responses
         session.httpSock = getSession->sock;
+        session.replySlot = getSession->slot;
         session.isHttp = true;
+        this->sessions.sender(session).sock = session.httpSock;
+        this->sessions.sender(session).outSlot = session.replySlot;
+        publishSubscribers();
         strncpy(session.sessionCookie, sessionCookie, MAX_COOKIE_LENGTH - 1);
         session.sessionCookie[MAX_COOKIE_LENGTH - 1] = '\0';
     } else {
@@ -561,94 +605,43 @@ bool RTSPServer::handleRTSPRequest(RTSP_Session& session) {
     }
   } else {
     // Handle regular RTSP commands
-    handleRTSPCommand(buffer, session);
+    handleRTSPCommand(request, *target);
+    LaxRTSPCompat::learnProfile(*this, *target);
   }
-
-  free(buffer);
-  return true;
 }
 
-void RTSPServer::sendUnauthorizedResponse(RTSP_Session& session) {
-  char response[256];
-  snprintf(response, sizeof(response),
-           "RTSP/1.0 401 Unauthorized\r\n"
-           "CSeq: %d\r\n"
-           "WWW-Authenticate: Basic realm=\"ESP32\"\r\n\r\n",
-           session.cseq);
+void RTSPServerBase::sendUnauthorizedResponse(RTSP_Session& session) {
+  RTSPResponse<128> response;
+  response.append(RTSP_STATUS_UNAUTHORIZED)
+          .append("CSeq: ").appendUInt(session.cseq).append("\r\n")
+          .append("WWW-Authenticate: Basic realm=\"ESP32\"\r\n")
+          .end();
   
-  write(session.isHttp ? session.httpSock : session.sock, response, strlen(response));
+  sendResponse(session, response.data(), response.size());
   RTSP_LOGW(LOG_TAG, "Sent 401 Unauthorized response to client.");
 }
 
-void RTSPServer::handleRTSPCommand(char* command, RTSP_Session& session) {
-  if (strncmp(command, "OPTIONS", 7) == 0) {
+void RTSPServerBase::handleRTSPCommand(const RTSP_Request& request, RTSP_Session& session) {
+  const RTSP_StringView& method = request.method;
+  if (method.equals("OPTIONS")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Options");
-    handleOptions(command, session);
-  } else if (strncmp(command, "DESCRIBE", 8) == 0) {
+    handleOptions(session);
+  } else if (method.equals("DESCRIBE")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Describe");
-    handleDescribe(session);
-  } else if (strncmp(command, "SETUP", 5) == 0) {
+    handleDescribe(request, session);
+  } else if (method.equals("SETUP")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Setup");
-    handleSetup(command, session);
-  } else if (strncmp(command, "PLAY", 4) == 0) {
+    handleSetup(request, session);
+  } else if (method.equals("PLAY")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Play");
     handlePlay(session);
-  } else if (strncmp(command, "TEARDOWN", 8) == 0) {
+  } else if (method.equals("TEARDOWN")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Teardown");
     handleTeardown(session);
-  } else if (strncmp(command, "PAUSE", 5) == 0) {
+  } else if (method.equals("PAUSE")) {
     RTSP_LOGD(LOG_TAG, "Handle RTSP Pause");
     handlePause(session);
   } else {
-    RTSP_LOGW(LOG_TAG, "Unknown RTSP method: %s", command);
+    RTSP_LOGW(LOG_TAG, "Unknown RTSP method: %.*s", static_cast<int>(method.len), method.data);
   }
 }
-
-bool RTSPServer::isBase64Encoded(const char* buffer, size_t length) {
-    // First check for spaces - if found, not base64
-    for (size_t i = 0; i < length; i++) {
-        if (isspace(buffer[i])) {
-            return false;
-        }
-    }
-
-    // Now check if it's valid base64
-    if (length % 4 != 0) {
-        return false;
-    }
-
-    for (size_t i = 0; i < length; i++) {
-        if (!isalnum(buffer[i]) && 
-            buffer[i] != '+' && 
-            buffer[i] != '/' && 
-            buffer[i] != '=') {
-            return false;
-        }
-    }
-
-    return true;
-}
-
-void RTSPServer::extractSessionCookie(const char* buffer, char* sessionCookie, size_t maxLen) {
-    const char* cookieHeader = strstr(buffer, "x-sessioncookie:");
-    if (cookieHeader) {
-        cookieHeader += strlen("x-sessioncookie:");
-        while (*cookieHeader == ' ') cookieHeader++;
-        const char* end = strstr(cookieHeader, "\r\n");
-        size_t len = end ? (size_t)(end - cookieHeader) : strlen(cookieHeader);
-        len = len < maxLen ? len : maxLen - 1;
-        strncpy(sessionCookie, cookieHeader, len);
-        sessionCookie[len] = '\0';
-    } else {
-        sessionCookie[0] = '\0';
-    }
-}
-
-RTSP_Session* RTSPServer::findSessionByCookie(const char* cookie) {
-    for (auto& pair : sessions) {
-        if (strcmp(pair.second.sessionCookie, cookie) == 0) {
-            return &pair.second;
-        }
-    }
-    return nullptr;
-}